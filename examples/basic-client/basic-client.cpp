@@ -57,14 +57,13 @@ void setup() {
 }
 
 void loop() {
-    if (!jtc.isConnected()) {
-        jtc.connect(2500);
-    } else {
-        if (performanceReport > PERF_REPORT_INTERVAL) {
-            Serial.printf("Audio memory in use: %d blocks; processor %f %%\n",
-                          AudioMemoryUsage(),
-                          AudioProcessorUsage());
-            performanceReport = 0;
-        }
+    // Connect to the server, and reconnect if it goes away, without blocking.
+    jtc.poll();
+
+    if (jtc.isConnected() && performanceReport > PERF_REPORT_INTERVAL) {
+        Serial.printf("Audio memory in use: %d blocks; processor %f %%\n",
+                      AudioMemoryUsage(),
+                      AudioProcessorUsage());
+        performanceReport = 0;
     }
 }
\ No newline at end of file
@@ -0,0 +1,429 @@
+#include <Audio.h>
+#include <CircularBufferMulti.h>
+#include <SampleFormat.h>
+#include <JackTripClient.h>
+
+// Wait for a serial connection before proceeding with execution
+#define WAIT_FOR_SERIAL
+//#undef WAIT_FOR_SERIAL
+
+// Length of the circular buffer under test, as used by JackTripClient.
+const uint16_t kBufferLength = AUDIO_BLOCK_SAMPLES * 8;
+// Number of blocks to read per timing measurement.
+const uint32_t kNumBlocks = 10'000;
+// Number of blocks to compare per quality measurement.
+const uint32_t kNumCompareBlocks = 1'000;
+// Channel counts to measure.
+const uint8_t kChannelCounts[]{2, 8, 16, 32};
+// Smallest packet size, in samples, for which to measure latency and
+// throughput; sizes double from here up to JACKTRIP_MAX_BUFFER_SIZE.
+const uint16_t kMinPacketSize = 8;
+// Bytes on the wire per UDP packet beyond the JackTrip packet itself:
+// preamble and inter-frame gap (20), Ethernet header and FCS (18), IPv4 (20)
+// and UDP (8) headers.
+const uint16_t kPacketOverhead = 66;
+// Channel count for which to report throughput.
+const uint8_t kThroughputChannels = 2;
+// Reads over which to measure receive latency, per packet size.
+const uint32_t kNumLatencyBlocks = 2'000;
+// Write:read ratio, i.e. simulated clock drift.
+const float kDriftRatio = 1.0001f;
+// Write:read ratio for quality measurements, as when resampling from a 48 kHz
+// server. At close to 1:1 the fractional read position barely moves over a
+// measurement, so only one phase of the interpolator would be compared; at
+// this ratio it sweeps [0, 1).
+const float kCompareRatio = 48'000.f / AUDIO_SAMPLE_RATE_EXACT;
+// Writes over which to prime. Enough back-to-back writes that the measured
+// jitter always pins the read position at the buffer's upper threshold, so
+// that every configuration reads from the same positions.
+const uint16_t kPrimingLength = 8;
+// Clients, and seconds of traffic, over which to simulate synchronised
+// playout.
+const uint8_t kNumSimulatedClients = 8;
+const uint32_t kSimulatedSeconds = 30;
+// Simulated network: one-way delays, in microseconds, range from the minimum
+// to the maximum, each packet taking an exponentially distributed extra
+// delay with the given mean.
+const uint32_t kMinNetworkDelay = 100;
+const uint32_t kMaxNetworkDelay = 600;
+const float kMeanNetworkJitter = 50.f;
+// Largest simulated clock skew, in ppm.
+const int32_t kMaxSkewPpm = 100;
+// Playout delay, in microseconds.
+const uint32_t kSimulatedPlayoutDelay = 3'000;
+
+// CPU cycles available per audio block.
+const float kCyclesPerBlock = static_cast<float>(F_CPU_ACTUAL) * AUDIO_BLOCK_SAMPLES / AUDIO_SAMPLE_RATE_EXACT;
+
+using Buffer = CircularBufferMulti<int16_t>;
+
+struct Config {
+    const char *name;
+    Buffer::DriftMode driftMode;
+    Buffer::Interpolation interpolation;
+};
+
+const Config kConfigs[]{
+        {"none          ", Buffer::DriftMode::INTERPOLATE,   Buffer::Interpolation::NONE},
+        {"linear        ", Buffer::DriftMode::INTERPOLATE,   Buffer::Interpolation::LINEAR},
+        {"cubic         ", Buffer::DriftMode::INTERPOLATE,   Buffer::Interpolation::CUBIC},
+        {"sinc          ", Buffer::DriftMode::INTERPOLATE,   Buffer::Interpolation::SINC},
+        {"cubic (table) ", Buffer::DriftMode::INTERPOLATE,   Buffer::Interpolation::CUBIC_TABLE},
+        {"insert/delete ", Buffer::DriftMode::INSERT_DELETE, Buffer::Interpolation::CUBIC},
+};
+
+//region Forward declarations
+float benchmark(const Config &config,
+                uint8_t numChannels,
+                uint32_t numBlocks = kNumBlocks,
+                int16_t *firstChannelOut = nullptr,
+                float ratio = kDriftRatio);
+
+void compare(const Config &reference, const Config &test);
+
+void benchmarkSampleFormats();
+
+void benchmarkReblocking();
+
+void simulateSynchronisedPlayout();
+//endregion
+
+void setup() {
+#ifdef WAIT_FOR_SERIAL
+    while (!Serial);
+#endif
+
+    Serial.printf("Sampling rate: %f\n", AUDIO_SAMPLE_RATE_EXACT);
+    Serial.printf("Audio block samples: %d\n", AUDIO_BLOCK_SAMPLES);
+    Serial.printf("Interpolation table phases: %d\n", 1 << INTERPOLATION_TABLE_BITS);
+    Serial.printf("CPU cycles per audio block: %.0f\n\n", kCyclesPerBlock);
+
+    Serial.println("mode           | channels | cycles/block | % of block");
+    for (auto numChannels: kChannelCounts) {
+        for (auto &config: kConfigs) {
+            auto cyclesPerBlock{benchmark(config, numChannels)};
+            Serial.printf("%s | %8d | %12.0f | %9.2f%%\n",
+                          config.name, numChannels, cyclesPerBlock, 100.f * cyclesPerBlock / kCyclesPerBlock);
+        }
+    }
+
+    // Compare the other interpolation methods against direct cubic.
+    Serial.println("\nmode           | SNR re cubic | max error");
+    const Config *reference{nullptr};
+    for (auto &config: kConfigs) {
+        if (config.driftMode == Buffer::DriftMode::INTERPOLATE && config.interpolation == Buffer::Interpolation::CUBIC) {
+            reference = &config;
+        }
+    }
+    for (auto &config: kConfigs) {
+        if (&config != reference && config.driftMode == Buffer::DriftMode::INTERPOLATE) {
+            compare(*reference, config);
+        }
+    }
+
+    benchmarkSampleFormats();
+    benchmarkReblocking();
+    simulateSynchronisedPlayout();
+}
+
+void loop() {}
+
+/**
+ * Time CircularBufferMulti::read() for a given configuration and channel
+ * count, writing blocks of sine waves, at a given ratio to the rate at which
+ * blocks are read, between reads.
+ * @param firstChannelOut if not null, receives numBlocks blocks of output from
+ * the first channel.
+ * @param ratio write:read ratio; by default, slightly faster writes than
+ * reads.
+ * @return mean CPU cycles per read.
+ */
+float benchmark(const Config &config, uint8_t numChannels, uint32_t numBlocks, int16_t *firstChannelOut,
+                float ratio) {
+    Buffer buffer{numChannels, kBufferLength, config.driftMode};
+    buffer.setInterpolation(config.interpolation);
+    buffer.setPrimingLength(kPrimingLength);
+    // Anything far from unity is resampling, rather than drift.
+    if (fabsf(ratio - 1.f) > .01f) {
+        buffer.setNominalRatio(ratio);
+        SincTable::prepare();
+    }
+
+    auto in = new int16_t *[numChannels];
+    auto out = new int16_t *[numChannels];
+    for (int ch = 0; ch < numChannels; ++ch) {
+        in[ch] = new int16_t[AUDIO_BLOCK_SAMPLES];
+        out[ch] = new int16_t[AUDIO_BLOCK_SAMPLES];
+    }
+
+    float phase{0.f}, writeDebt{0.f};
+    uint32_t cycles{0};
+
+    for (uint32_t b = 0; b < numBlocks; ++b) {
+        writeDebt += ratio;
+        while (writeDebt >= 1.f) {
+            for (int n = 0; n < AUDIO_BLOCK_SAMPLES; ++n) {
+                for (int ch = 0; ch < numChannels; ++ch) {
+                    in[ch][n] = static_cast<int16_t>(16000.f * sinf(phase));
+                }
+                phase += .0628f;
+                if (phase > TWO_PI) {
+                    phase -= TWO_PI;
+                }
+            }
+            buffer.write(const_cast<const int16_t **>(in), AUDIO_BLOCK_SAMPLES);
+            writeDebt -= 1.f;
+        }
+
+        auto start{ARM_DWT_CYCCNT};
+        buffer.read(out, AUDIO_BLOCK_SAMPLES);
+        cycles += ARM_DWT_CYCCNT - start;
+
+        if (firstChannelOut) {
+            memcpy(firstChannelOut + b * AUDIO_BLOCK_SAMPLES, out[0], AUDIO_BLOCK_SAMPLES * sizeof(int16_t));
+        }
+    }
+
+    for (int ch = 0; ch < numChannels; ++ch) {
+        delete[] in[ch];
+        delete[] out[ch];
+    }
+    delete[] in;
+    delete[] out;
+
+    return static_cast<float>(cycles) / static_cast<float>(numBlocks);
+}
+
+/**
+ * Report the difference between the output of two configurations, given
+ * identical input, resampled at kCompareRatio so that every fractional read
+ * position is exercised.
+ */
+void compare(const Config &reference, const Config &test) {
+    auto length{kNumCompareBlocks * AUDIO_BLOCK_SAMPLES};
+    auto refOut = new int16_t[length];
+    auto testOut = new int16_t[length];
+
+    benchmark(reference, 1, kNumCompareBlocks, refOut, kCompareRatio);
+    benchmark(test, 1, kNumCompareBlocks, testOut, kCompareRatio);
+
+    double signal{0.}, noise{0.};
+    int32_t maxError{0};
+    for (uint32_t n = 0; n < length; ++n) {
+        auto error{static_cast<int32_t>(testOut[n]) - refOut[n]};
+        signal += static_cast<double>(refOut[n]) * refOut[n];
+        noise += static_cast<double>(error) * error;
+        maxError = max(maxError, abs(error));
+    }
+
+    Serial.printf("%s | %9.1f dB | %9" PRId32 "\n",
+                  test.name, noise > 0. ? 10. * log10(signal / noise) : INFINITY, maxError);
+
+    delete[] refOut;
+    delete[] testOut;
+}
+
+/**
+ * Time conversion of one packet's worth of audio from and to each wire
+ * format, per channel count, and measure the signal-to-noise ratio of the
+ * round trip.
+ */
+void benchmarkSampleFormats() {
+    const uint8_t bitResolutions[]{ADPCM_BIT_RESOLUTION, 8, 16, 24, 32};
+    int16_t samples[AUDIO_BLOCK_SAMPLES], decoded[AUDIO_BLOCK_SAMPLES];
+    uint8_t wire[AUDIO_BLOCK_SAMPLES * BIT32];
+    float phase{0.f};
+
+    Serial.println("\nbits | channels | unpack cycles/block | pack cycles/block | % of block | SNR");
+    for (auto bits: bitResolutions) {
+        // Signal to noise ratio of a sine wave, over several packets.
+        double signal{0.}, noise{0.};
+        for (uint32_t b = 0; b < kNumCompareBlocks; ++b) {
+            for (int n = 0; n < AUDIO_BLOCK_SAMPLES; ++n) {
+                samples[n] = static_cast<int16_t>(16000.f * sinf(phase));
+                phase += .0628f;
+                if (phase > TWO_PI) {
+                    phase -= TWO_PI;
+                }
+            }
+            packSamples(samples, wire, AUDIO_BLOCK_SAMPLES, bits);
+            unpackSamples(wire, decoded, AUDIO_BLOCK_SAMPLES, bits);
+            for (int n = 0; n < AUDIO_BLOCK_SAMPLES; ++n) {
+                auto error{static_cast<double>(decoded[n] - samples[n])};
+                signal += static_cast<double>(samples[n]) * samples[n];
+                noise += error * error;
+            }
+        }
+        auto snr{noise > 0. ? 10. * log10(signal / noise) : INFINITY};
+
+        for (auto numChannels: kChannelCounts) {
+            uint32_t unpackCycles{0}, packCycles{0};
+            for (uint32_t b = 0; b < kNumCompareBlocks; ++b) {
+                for (int ch = 0; ch < numChannels; ++ch) {
+                    auto start{ARM_DWT_CYCCNT};
+                    packSamples(samples, wire, AUDIO_BLOCK_SAMPLES, bits);
+                    packCycles += ARM_DWT_CYCCNT - start;
+                    start = ARM_DWT_CYCCNT;
+                    unpackSamples(wire, decoded, AUDIO_BLOCK_SAMPLES, bits);
+                    unpackCycles += ARM_DWT_CYCCNT - start;
+                }
+            }
+            auto unpack{static_cast<float>(unpackCycles) / kNumCompareBlocks};
+            auto pack{static_cast<float>(packCycles) / kNumCompareBlocks};
+            Serial.printf("%4d | %8d | %19.0f | %17.0f | %9.2f%% | %5.1f dB\n",
+                          bits, numChannels, unpack, pack, 100.f * (unpack + pack) / kCyclesPerBlock, snr);
+        }
+    }
+
+    // Checking for silence, for DTX, must scan a silent block in full.
+    memset(samples, 0, sizeof(samples));
+    Serial.println("\nchannels | silence check cycles/block | % of block");
+    for (auto numChannels: kChannelCounts) {
+        uint32_t cycles{0}, numSilent{0};
+        for (uint32_t b = 0; b < kNumCompareBlocks; ++b) {
+            auto start{ARM_DWT_CYCCNT};
+            for (int ch = 0; ch < numChannels; ++ch) {
+                numSilent += isSilent(samples, AUDIO_BLOCK_SAMPLES, 0);
+            }
+            cycles += ARM_DWT_CYCCNT - start;
+        }
+        auto perBlock{static_cast<float>(cycles) / kNumCompareBlocks};
+        Serial.printf("%8d | %25.0f | %9.2f%%%s\n", numChannels, perBlock, 100.f * perBlock / kCyclesPerBlock,
+                      numSilent == numChannels * kNumCompareBlocks ? "" : " (not silent!)");
+    }
+}
+
+/**
+ * Measure the latency added on receipt of packets of each server buffer size,
+ * read in blocks of AUDIO_BLOCK_SAMPLES, and on sending packets of each size,
+ * sized as in JackTripClient, alongside the packet rate and bit rate on the
+ * wire. Packets are written in real time, without jitter, so the receive
+ * buffer's delay is the least it would settle on.
+ */
+void benchmarkReblocking() {
+    int16_t block[JACKTRIP_MAX_BUFFER_SIZE]{};
+    const int16_t *in[]{block};
+    int16_t outBlock[AUDIO_BLOCK_SAMPLES];
+    int16_t *out[]{outBlock};
+    auto readPeriod{1e6f * AUDIO_BLOCK_SAMPLES / AUDIO_SAMPLE_RATE_EXACT};
+
+    Serial.printf("\npacket size | blocks | receive delay | send delay | packets/s | kbit/s (%d ch)\n",
+                  kThroughputChannels);
+    for (uint16_t packetSize = kMinPacketSize; packetSize <= JACKTRIP_MAX_BUFFER_SIZE; packetSize *= 2) {
+        Buffer buffer{1, kBufferLength / AUDIO_BLOCK_SAMPLES * JACKTRIP_MAX_BUFFER_SIZE};
+        buffer.setLength(kBufferLength / AUDIO_BLOCK_SAMPLES * max(packetSize, static_cast<uint16_t>(AUDIO_BLOCK_SAMPLES)));
+
+        auto writePeriod{1e6f * static_cast<float>(packetSize) / AUDIO_SAMPLE_RATE_EXACT};
+        float nextWrite{0.f}, nextRead{0.f}, totalDelay{0.f};
+        uint32_t numReads{0};
+        elapsedMicros now;
+
+        while (numReads < kNumLatencyBlocks) {
+            if (static_cast<float>(now) >= nextWrite) {
+                buffer.write(in, packetSize);
+                nextWrite += writePeriod;
+            }
+            if (static_cast<float>(now) >= nextRead) {
+                buffer.read(out, AUDIO_BLOCK_SAMPLES);
+                nextRead += readPeriod;
+                if (buffer.isPrimed()) {
+                    auto delay{static_cast<float>(buffer.getWriteIndex()) - buffer.getReadPosition()};
+                    if (delay < 0.f) {
+                        delay += static_cast<float>(buffer.getLength());
+                    }
+                    totalDelay += delay;
+                    ++numReads;
+                }
+            }
+        }
+
+        // The first sample of each outgoing packet waits for the rest.
+        auto sendDelay{max(packetSize - AUDIO_BLOCK_SAMPLES, 0)};
+        auto packetsPerSecond{AUDIO_SAMPLE_RATE_EXACT / static_cast<float>(packetSize)};
+        auto bytesPerPacket{kPacketOverhead + PACKET_HEADER_SIZE + kThroughputChannels * packetSize * BIT16};
+        Serial.printf("%11d | %6.2f | %10.2f ms | %7.2f ms | %9.0f | %13.0f\n",
+                      packetSize,
+                      static_cast<float>(packetSize) / AUDIO_BLOCK_SAMPLES,
+                      1000.f * totalDelay / static_cast<float>(numReads) / AUDIO_SAMPLE_RATE_EXACT,
+                      1000.f * static_cast<float>(sendDelay) / AUDIO_SAMPLE_RATE_EXACT,
+                      packetsPerSecond,
+                      packetsPerSecond * static_cast<float>(bytesPerPacket) * 8.f / 1000.f);
+    }
+}
+
+/**
+ * Simulate several clients receiving the same stream over different network
+ * paths, each with its own clock, and compare when each would play the same
+ * block: scheduled via ClockEstimator, as with setPlayoutDelay() alone, and
+ * via ClockSync, as with setSynchronisedPlayout() too. Each client's
+ * estimators see packet arrivals only at its audio updates, as in
+ * JackTripClient. Reports, in samples, how much later than intended each
+ * client would play, and the spread across clients.
+ */
+void simulateSynchronisedPlayout() {
+    const uint64_t serverOrigin{1'700'000'000'000'000};
+    const double packetPeriod{1e6 * AUDIO_BLOCK_SAMPLES / AUDIO_SAMPLE_RATE_EXACT};
+    const double requestInterval{10'000.};
+    const double turnaround{20.};
+    const double duration{kSimulatedSeconds * 1e6};
+    const double samplesPerMicro{AUDIO_SAMPLE_RATE_EXACT / 1e6};
+
+    auto jitter = [] {
+        return -kMeanNetworkJitter * logf(1.f - static_cast<float>(random(1'000'000)) / 1e6f);
+    };
+
+    float minEstimated{INFINITY}, maxEstimated{-INFINITY}, minSynchronised{INFINITY}, maxSynchronised{-INFINITY};
+
+    Serial.printf("\nclient | skew (ppm) | delay (µs) | lateness, samples: min-delay | synchronised | accuracy (µs)\n");
+    for (uint8_t client = 0; client < kNumSimulatedClients; ++client) {
+        // Local microseconds per server microsecond, and local time at server
+        // time serverOrigin.
+        auto skew{1. + 1e-6 * static_cast<double>(random(-kMaxSkewPpm, kMaxSkewPpm + 1))};
+        auto localOrigin{static_cast<double>(random(0, INT32_MAX))};
+        auto delay{static_cast<double>(random(kMinNetworkDelay, kMaxNetworkDelay + 1))};
+        auto updatePhase{static_cast<double>(random(0, static_cast<int32_t>(packetPeriod)))};
+
+        auto toLocal = [&](double server) { return localOrigin + server * skew; };
+        auto toServer = [&](double local) { return (local - localOrigin) / skew; };
+        // Packets are only seen at the next audio update.
+        auto seenAt = [&](double local) {
+            return static_cast<uint32_t>(static_cast<uint64_t>(
+                    updatePhase + ceil((local - updatePhase) / packetPeriod) * packetPeriod));
+        };
+
+        ClockEstimator estimator;
+        for (double server = 0.; server < duration; server += packetPeriod) {
+            estimator.update(serverOrigin + static_cast<uint64_t>(server),
+                             seenAt(toLocal(server) + delay + jitter()));
+        }
+
+        ClockSync sync;
+        for (double local = toLocal(0.); local < toLocal(duration);
+             local += requestInterval + static_cast<double>(random(1000))) {
+            ClockSyncPacket packet;
+            sync.makeRequest(packet, static_cast<uint32_t>(static_cast<uint64_t>(local)));
+            auto arrival{local + delay + jitter()};
+            packet.ServerReceive = serverOrigin + static_cast<uint64_t>(toServer(arrival));
+            packet.ServerSend = packet.ServerReceive + static_cast<uint64_t>(turnaround);
+            sync.registerResponse(packet, seenAt(arrival + turnaround * skew + delay + jitter()));
+        }
+
+        // When each method would play the block sent at the end, relative to
+        // when it should, in samples.
+        auto intended{static_cast<uint32_t>(static_cast<uint64_t>(toLocal(duration + kSimulatedPlayoutDelay)))};
+        auto timestamp{serverOrigin + static_cast<uint64_t>(duration)};
+        auto estimated{samplesPerMicro * static_cast<float>(static_cast<int32_t>(
+                estimator.toLocal(timestamp) + kSimulatedPlayoutDelay - intended))};
+        auto synchronised{samplesPerMicro * static_cast<float>(static_cast<int32_t>(
+                sync.toLocal(timestamp + kSimulatedPlayoutDelay) - intended))};
+
+        minEstimated = min(minEstimated, estimated);
+        maxEstimated = max(maxEstimated, estimated);
+        minSynchronised = min(minSynchronised, synchronised);
+        maxSynchronised = max(maxSynchronised, synchronised);
+        Serial.printf("%6d | %10.0f | %10.0f | %27.2f | %12.2f | %13.1f\n",
+                      client, 1e6 * (skew - 1.), delay, estimated, synchronised, sync.getAccuracy());
+    }
+    Serial.printf("spread | %10s | %10s | %27.2f | %12.2f |\n",
+                  "", "", maxEstimated - minEstimated, maxSynchronised - minSynchronised);
+}
@@ -0,0 +1,36 @@
+#include "ReferenceSawtooth.h"
+
+ReferenceSawtooth::ReferenceSawtooth(JackTripClient &client, float delayMS, float serverSampleRate)
+        : AudioStream{0, nullptr},
+          client{client},
+          kDelay{static_cast<uint32_t>(delayMS * 1000.f)},
+          kServerSampleRate{serverSampleRate} {
+}
+
+void ReferenceSawtooth::update() {
+    uint64_t serverTime;
+    if (!client.getServerTime(serverTime)) {
+        return;
+    }
+
+    auto block{allocate()};
+    if (!block) {
+        return;
+    }
+
+    // Position in the sawtooth of the block's first sample; whole seconds
+    // and microseconds are taken separately, lest the product overflow.
+    auto time{serverTime - kDelay};
+    auto rate{static_cast<uint64_t>(kServerSampleRate)};
+    auto position{static_cast<double>((time / 1'000'000 * rate) % PERIOD)
+                  + static_cast<double>(time % 1'000'000) * kServerSampleRate / 1e6};
+    auto increment{kServerSampleRate / AUDIO_SAMPLE_RATE_EXACT};
+
+    for (int n = 0; n < AUDIO_BLOCK_SAMPLES; ++n) {
+        block->data[n] = static_cast<int16_t>(static_cast<uint32_t>(position) % PERIOD);
+        position += increment;
+    }
+
+    transmit(block);
+    release(block);
+}
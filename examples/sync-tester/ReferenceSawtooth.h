@@ -0,0 +1,36 @@
+#ifndef JACKTRIP_TEENSY_REFERENCESAWTOOTH_H
+#define JACKTRIP_TEENSY_REFERENCESAWTOOTH_H
+
+#include <Audio.h>
+#include <JackTripClient.h>
+
+/**
+ * Generates the unipolar sawtooth that SyncTester compares incoming audio
+ * against, in phase with a JackTripClient's estimate of the server's time,
+ * less a playout delay. Each sample's value is its time, in server samples
+ * since the epoch, modulo 32768, as sent by scripts/multicast-sender.py
+ * --sawtooth; so the offset SyncTester measures is how late this client
+ * plays, in samples, and is the same for every synchronised client. Silent
+ * until the client has an estimate.
+ */
+class ReferenceSawtooth : public AudioStream {
+public:
+    /**
+     * @param client the client whose clock sync estimate to follow.
+     * @param delayMS the client's playout delay, in milliseconds.
+     * @param serverSampleRate the server's sampling rate, in Hz.
+     */
+    ReferenceSawtooth(JackTripClient &client, float delayMS, float serverSampleRate = 44100.f);
+
+    void update() override;
+
+private:
+    static constexpr uint32_t PERIOD{1 << 15};
+
+    JackTripClient &client;
+    const uint32_t kDelay;
+    const float kServerSampleRate;
+};
+
+
+#endif //JACKTRIP_TEENSY_REFERENCESAWTOOTH_H
@@ -9835,8 +9835,6 @@ class mydsp : public dsp {
 	
  public:
 	
-	FAUSTFLOAT fButton0;
-	float fRec0[2];
 	int fSampleRate;
 	
  public:
@@ -9850,16 +9848,12 @@ class mydsp : public dsp {
 		m->declare("maths.lib/name", "Faust Math Library");
 		m->declare("maths.lib/version", "2.5");
 		m->declare("name", "SyncTester");
-		m->declare("oscillators.lib/lf_sawpos_reset:author", "Bart Brouns, revised by Stéphane Letz");
-		m->declare("oscillators.lib/lf_sawpos_reset:licence", "STK-4.3");
-		m->declare("oscillators.lib/name", "Faust Oscillator Library");
-		m->declare("oscillators.lib/version", "0.3");
 		m->declare("platform.lib/name", "Generic Platform Library");
 		m->declare("platform.lib/version", "0.3");
 	}
 
 	virtual int getNumInputs() {
-		return 1;
+		return 2;
 	}
 	virtual int getNumOutputs() {
 		return 1;
@@ -9873,13 +9867,9 @@ class mydsp : public dsp {
 	}
 	
 	virtual void instanceResetUserInterface() {
-		fButton0 = FAUSTFLOAT(0.0f);
 	}
 	
 	virtual void instanceClear() {
-		for (int l0 = 0; l0 < 2; l0 = l0 + 1) {
-			fRec0[l0] = 0.0f;
-		}
 	}
 	
 	virtual void init(int sample_rate) {
@@ -9902,20 +9892,17 @@ class mydsp : public dsp {
 	
 	virtual void buildUserInterface(UI* ui_interface) {
 		ui_interface->openVerticalBox("SyncTester");
-		ui_interface->addButton("reset", &fButton0);
 		ui_interface->closeBox();
 	}
 	
 	virtual void compute(int count, FAUSTFLOAT** RESTRICT inputs, FAUSTFLOAT** RESTRICT outputs) {
 		FAUSTFLOAT* input0 = inputs[0];
+		FAUSTFLOAT* input1 = inputs[1];
 		FAUSTFLOAT* output0 = outputs[0];
-		int iSlow0 = int(float(fButton0));
 		for (int i0 = 0; i0 < count; i0 = i0 + 1) {
-			float fTemp0 = ((iSlow0) ? 0.0f : fRec0[1] + 3.0517578e-05f);
-			fRec0[0] = fTemp0 - std::floor(fTemp0);
-			float fTemp1 = float(input0[i0]);
-			output0[i0] = FAUSTFLOAT(((fRec0[0] >= fTemp1) ? fTemp1 + (1.0f - fRec0[0]) : fTemp1 - fRec0[0]));
-			fRec0[1] = fRec0[0];
+			float fTemp0 = float(input0[i0]);
+			float fTemp1 = float(input1[i0]);
+			output0[i0] = FAUSTFLOAT(((fTemp1 >= fTemp0) ? fTemp0 + (1.0f - fTemp1) : fTemp0 - fTemp1));
 		}
 	}
 
@@ -9926,15 +9913,13 @@ class mydsp : public dsp {
 	#define FAUST_FILE_NAME "SyncTester.dsp"
 	#define FAUST_CLASS_NAME "mydsp"
 	#define FAUST_COMPILATION_OPIONS "-a /usr/local/share/faust/teensy/teensy.cpp -lang cpp -i -es 1 -mcd 16 -uim -single -ftz 0"
-	#define FAUST_INPUTS 1
+	#define FAUST_INPUTS 2
 	#define FAUST_OUTPUTS 1
-	#define FAUST_ACTIVES 1
+	#define FAUST_ACTIVES 0
 	#define FAUST_PASSIVES 0
 
-	FAUST_ADDBUTTON("reset", fButton0);
 
 	#define FAUST_LIST_ACTIVES(p) \
-		p(BUTTON, reset, "reset", fButton0, 0.0f, 0.0f, 1.0f, 1.0f) \
 
 	#define FAUST_LIST_PASSIVES(p) \
 
@@ -1,6 +1,7 @@
 #include <Audio.h>
 #include <JackTripClient.h>
 #include "SyncTester/SyncTester.h"
+#include "ReferenceSawtooth.h"
 
 // Wait for a serial connection before proceeding with execution
 #define WAIT_FOR_SERIAL
@@ -14,6 +15,18 @@
 #define SHOW_STATS
 //#undef SHOW_STATS
 
+// Define this to receive scripts/multicast-sender.py --sawtooth --port 8888,
+// whose timestamps are on the clock sync responder's clock, rather than
+// connect to a JackTrip server.
+#define USE_MULTICAST
+#undef USE_MULTICAST
+
+// Define this to play each block at the same instant as every other client.
+// Requires scripts/clock-sync-responder.py running on the server's host;
+// without it, the reference sawtooth is silent.
+#define USE_CLOCK_SYNC
+#undef USE_CLOCK_SYNC
+
 // Shorthand to block and do nothing
 #define WAIT_INFINITE() while (true) yield();
 
@@ -21,6 +34,14 @@
 const uint16_t kLocalUdpPort = 8888;
 // Remote server IP address -- should match address in IPv4 settings.
 IPAddress jackTripServerIP{192, 168, 10, 10};
+// Multicast group to join, if USE_MULTICAST is defined.
+IPAddress multicastGroup{239, 1, 2, 3};
+// UDP port of scripts/clock-sync-responder.py on the server's host, if
+// USE_CLOCK_SYNC is defined.
+const uint16_t kClockSyncPort = 61003;
+// Delay between a block's server timestamp and its playout; must exceed the
+// network delay to every client.
+const float kPlayoutDelayMS = 3.f;
 
 // Audio shield driver
 AudioControlSGTL5000 audioShield;
@@ -28,6 +49,7 @@ AudioOutputI2S out;
 
 JackTripClient jtc{NUM_JACKTRIP_CHANNELS, jackTripServerIP};
 SyncTester st;
+ReferenceSawtooth referenceSaw{jtc, kPlayoutDelayMS};
 
 // Send input from server back to server.
 AudioConnection patchCord10(jtc, 0, jtc, 0);
@@ -35,7 +57,9 @@ AudioConnection patchCord10(jtc, 0, jtc, 0);
 AudioConnection patchCord20(jtc, 0, out, 0);
 // Send input to synchronicity tester.
 AudioConnection patchCord30(jtc, 0, st, 0);
-// Combine with generated sawtooth.
+// Compare with a sawtooth generated from the shared time base.
+AudioConnection patchCord35(referenceSaw, 0, st, 1);
+// Send synchronicity measure to audio output.
 AudioConnection patchCord40(st, 0, out, 1);
 // Send synchronicity measure back to server.
 AudioConnection patchCord50(st, 0, jtc, 1);
@@ -65,7 +89,16 @@ void setup() {
     jtc.setShowStats(true, 5'000);
 #endif
 
-//    jtc.setOnConnected([] { s.setParamValue("reset", 1); });
+#ifdef USE_MULTICAST
+    jtc.setMulticast(multicastGroup, 0, NUM_JACKTRIP_CHANNELS);
+#endif
+
+#ifdef USE_CLOCK_SYNC
+    // Play each block at the same instant as every other client.
+    jtc.setClockSync(kClockSyncPort);
+    jtc.setPlayoutDelay(kPlayoutDelayMS);
+    jtc.setSynchronisedPlayout(true);
+#endif
 
     if (!jtc.begin(kLocalUdpPort)) {
         Serial.println("Failed to initialise jacktrip client.");
@@ -78,15 +111,14 @@ void setup() {
 }
 
 void loop() {
-    if (!jtc.isConnected()) {
-        jtc.connect(2500);
-    } else {
-        if (performanceReport > PERF_REPORT_INTERVAL) {
-            Serial.printf("Audio memory in use: %d blocks; processor %f %%\n",
-                          AudioMemoryUsage(),
-                          AudioProcessorUsage());
-            performanceReport = 0;
-        }
+    // Connect, reconnect, and synchronise clocks, without blocking.
+    jtc.poll();
+
+    if (jtc.isConnected() && performanceReport > PERF_REPORT_INTERVAL) {
+        Serial.printf("Audio memory in use: %d blocks; processor %f %%\n",
+                      AudioMemoryUsage(),
+                      AudioProcessorUsage());
+        performanceReport = 0;
     }
 }
 
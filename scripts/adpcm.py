@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+
+"""
+Host-side IMA-ADPCM encoder/decoder matching JackTripClient's ADPCM wire
+format (see src/SampleFormat.h): each channel of each packet is coded
+independently, as the first sample (int16), the initial step index and a zero
+byte, followed by the remaining samples' 4-bit codes, low nibble first.
+
+As a script, round-trips a 16-bit WAV file through the codec, a packet's
+worth of samples at a time, and reports the signal-to-noise ratio:
+
+  ./adpcm.py in.wav out.wav --buffer-size 32
+"""
+
+import argparse
+import math
+import struct
+import sys
+import wave
+
+BIT_RESOLUTION = 4
+HEADER_SIZE = 4
+
+STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88,
+    97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+    724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660,
+    4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818,
+    18500, 20350, 22385, 24623, 27086, 29794, 32767
+]
+INDEX_ADJUST = [-1, -1, -1, -1, 2, 4, 6, 8]
+MAX_INDEX = len(STEPS) - 1
+
+
+def channel_bytes(num_samples):
+    """Bytes occupied by one channel's worth of coded samples."""
+    return HEADER_SIZE + num_samples // 2
+
+
+def _step(code, predictor, index):
+    step = STEPS[index]
+    diff = step >> 3
+    if code & 4:
+        diff += step
+    if code & 2:
+        diff += step >> 1
+    if code & 1:
+        diff += step >> 2
+    predictor = predictor - diff if code & 8 else predictor + diff
+    predictor = max(-32768, min(32767, predictor))
+    index = max(0, min(MAX_INDEX, index + INDEX_ADJUST[code & 7]))
+    return predictor, index
+
+
+def encode(samples):
+    """Code a list of int16 samples as one channel of a packet."""
+    if not samples:
+        return b''
+
+    predictor = samples[0]
+    index = 0
+    if len(samples) > 1:
+        first_diff = abs(samples[1] - samples[0])
+        while index < MAX_INDEX and STEPS[index] * 2 < first_diff:
+            index += 1
+
+    out = bytearray(struct.pack('<hBB', predictor, index, 0))
+    out += bytes(len(samples) // 2)
+    for n, sample in enumerate(samples[1:], start=1):
+        diff = sample - predictor
+        code = 0
+        if diff < 0:
+            code = 8
+            diff = -diff
+        step = STEPS[index]
+        if diff >= step:
+            code |= 4
+            diff -= step
+        step >>= 1
+        if diff >= step:
+            code |= 2
+            diff -= step
+        step >>= 1
+        if diff >= step:
+            code |= 1
+        predictor, index = _step(code, predictor, index)
+
+        if n & 1:
+            out[HEADER_SIZE + ((n - 1) >> 1)] = code
+        else:
+            out[HEADER_SIZE + ((n - 1) >> 1)] |= code << 4
+    return bytes(out)
+
+
+def decode(data, num_samples):
+    """Decode one channel of a packet to a list of int16 samples."""
+    if num_samples == 0:
+        return []
+
+    predictor, index, _ = struct.unpack_from('<hBB', data)
+    index = min(index, MAX_INDEX)
+    samples = [predictor]
+    for n in range(1, num_samples):
+        byte = data[HEADER_SIZE + ((n - 1) >> 1)]
+        predictor, index = _step(byte & 0xf if n & 1 else byte >> 4, predictor, index)
+        samples.append(predictor)
+    return samples
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help='16-bit WAV file to code')
+    parser.add_argument('output', help='WAV file to which to write the decoded audio')
+    parser.add_argument('--buffer-size', type=int, default=32, help='samples per channel per packet')
+    args = parser.parse_args()
+
+    with wave.open(args.input, 'rb') as wav:
+        if wav.getsampwidth() != 2:
+            sys.exit('Expected 16-bit samples')
+        params = wav.getparams()
+        frames = wav.readframes(wav.getnframes())
+
+    num_channels = params.nchannels
+    interleaved = struct.unpack(f'<{len(frames) // 2}h', frames)
+    channels = [list(interleaved[ch::num_channels]) for ch in range(num_channels)]
+
+    signal = noise = 0
+    decoded = []
+    for samples in channels:
+        out = []
+        for start in range(0, len(samples), args.buffer_size):
+            block = samples[start:start + args.buffer_size]
+            out += decode(encode(block), len(block))
+        signal += sum(s * s for s in samples)
+        noise += sum((d - s) ** 2 for d, s in zip(out, samples))
+        decoded.append(out)
+
+    with wave.open(args.output, 'wb') as wav:
+        wav.setparams(params)
+        wav.writeframes(struct.pack(f'<{len(interleaved)}h', *(s for frame in zip(*decoded) for s in frame)))
+
+    snr = 10 * math.log10(signal / noise) if noise > 0 else math.inf
+    print(f'{num_channels} channels, {len(channels[0])} frames; SNR {snr:.1f} dB; '
+          f'{channel_bytes(args.buffer_size)} bytes per {args.buffer_size} samples')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+
+"""
+Answers JackTripClient clock sync requests (see setClockSync()), standing in
+for the server's end of the exchange. Each request is returned to its sender
+with the times at which it arrived and the response was sent, in
+microseconds since the epoch. Run it on the JackTrip server's host, so that
+clients synchronise to that host's clock. Once every --report seconds, lists
+the clients heard from.
+
+  ./clock-sync-responder.py --port 61003
+"""
+
+import argparse
+import socket
+import struct
+import time
+
+# ClockSyncPacket: Magic, Id, ClientSend, ServerReceive, ServerSend.
+PACKET = struct.Struct('<8sIIQQ')
+MAGIC = b'JTCLKSYN'
+
+
+def now_us():
+    return time.time_ns() // 1000
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--port', type=int, default=61003, help='UDP port on which to listen')
+    parser.add_argument('--report', type=float, default=5., help='seconds between reports; 0 not to report')
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('', args.port))
+    print(f'Listening on port {args.port}')
+
+    requests = {}
+    last_report = time.monotonic()
+
+    while True:
+        try:
+            packet, sender = sock.recvfrom(1500)
+        except KeyboardInterrupt:
+            break
+        received = now_us()
+        if len(packet) != PACKET.size:
+            continue
+        magic, request_id, client_send, _, _ = PACKET.unpack(packet)
+        if magic != MAGIC:
+            continue
+
+        # Fill in the send time as late as possible.
+        sock.sendto(PACKET.pack(magic, request_id, client_send, received, now_us()), sender)
+        requests[sender] = requests.get(sender, 0) + 1
+
+        now = time.monotonic()
+        if args.report and now - last_report >= args.report:
+            for (host, port), count in sorted(requests.items()):
+                print(f'{host}:{port}: {count / (now - last_report):.1f} requests/s')
+            requests.clear()
+            last_report = now
+
+
+if __name__ == '__main__':
+    main()
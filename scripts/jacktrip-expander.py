@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+
+"""
+Stands in for a hub receiving from JackTripClients that send with DTX
+(setDtx()) or split packets (setMtu()). Silent channels left out of a packet
+are restored as zeros, and the channels of split packets are reassembled, so
+that each block becomes an ordinary JackTrip packet. These may be forwarded
+elsewhere, e.g. to a JackTrip instance expecting plain packets, with
+--forward. Once a second, reports bytes received against bytes that would
+have been received without DTX.
+
+  ./jacktrip-expander.py --port 61002 --forward 127.0.0.1:61003
+"""
+
+import argparse
+import socket
+import struct
+import time
+
+import adpcm
+
+# JackTripPacketHeader: TimeStamp, SeqNumber, BufferSize, SamplingRate,
+# BitResolution, NumIncomingChannelsFromNet, NumOutgoingChannelsToNet.
+HEADER = struct.Struct('<QHHBBBB')
+# Flags JackTripClient may set in BitResolution; see src/PacketHeader.h.
+SUB_STREAM_FLAG = 0x40
+DTX_FLAG = 0x80
+SUB_STREAM_HEADER = struct.Struct('<BB')
+JACKTRIP_EXIT_PACKET_SIZE = 63
+
+
+def channel_bytes(bits, buffer_size):
+    if bits == adpcm.BIT_RESOLUTION:
+        return adpcm.channel_bytes(buffer_size)
+    return buffer_size * bits // 8
+
+
+def silent_channel(bits, buffer_size):
+    """One channel of silence in the given wire format."""
+    if bits == adpcm.BIT_RESOLUTION:
+        return adpcm.encode([0] * buffer_size)
+    return bytes(channel_bytes(bits, buffer_size))
+
+
+def parse(packet):
+    """
+    Split a packet into its header fields and a list of channels, in which
+    silent channels are None.
+    @return (header fields, first channel, total channels, channels), or None
+    if the packet is malformed.
+    """
+    if len(packet) < HEADER.size:
+        return None
+    fields = list(HEADER.unpack_from(packet))
+    bits, channels = fields[4], fields[5]
+    offset = HEADER.size
+    first, total = 0, channels
+
+    if bits & SUB_STREAM_FLAG:
+        if len(packet) < offset + SUB_STREAM_HEADER.size:
+            return None
+        first, total = SUB_STREAM_HEADER.unpack_from(packet, offset)
+        offset += SUB_STREAM_HEADER.size
+    present = [True] * channels
+    if bits & DTX_FLAG:
+        mask_size = (channels + 7) // 8
+        mask = packet[offset:offset + mask_size]
+        present = [len(mask) == mask_size and bool(mask[c // 8] >> (c % 8) & 1) for c in range(channels)]
+        offset += mask_size
+    fields[4] = bits = bits & ~(SUB_STREAM_FLAG | DTX_FLAG)
+
+    size = channel_bytes(bits, fields[2])
+    if size == 0 or len(packet) != offset + present.count(True) * size or first + channels > total:
+        return None
+    data = []
+    for c in range(channels):
+        if present[c]:
+            data.append(packet[offset:offset + size])
+            offset += size
+        else:
+            data.append(None)
+    return fields, first, total, data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--port', type=int, default=61002, help='UDP port on which to receive')
+    parser.add_argument('--forward', help='host:port to which to send expanded packets')
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('', args.port))
+    forward = None
+    if args.forward:
+        host, port = args.forward.rsplit(':', 1)
+        forward = (host, int(port))
+    print(f'Listening on port {args.port}')
+
+    # The block being reassembled, per sender: its header fields, channels
+    # (None if silent or yet to arrive), and which channels have arrived.
+    blocks = {}
+    bytes_in = bytes_out = packets = silent = channels_seen = 0
+    last_report = time.monotonic()
+
+    def flush(sender):
+        fields, channels, _ = blocks.pop(sender)
+        nonlocal bytes_out, silent, channels_seen
+        bits, buffer_size = fields[4], fields[2]
+        fields[5] = len(channels)
+        payload = b''.join(silent_channel(bits, buffer_size) if c is None else c for c in channels)
+        silent += channels.count(None)
+        channels_seen += len(channels)
+        packet = HEADER.pack(*fields) + payload
+        bytes_out += len(packet)
+        if forward:
+            sock.sendto(packet, forward)
+
+    while True:
+        try:
+            packet, sender = sock.recvfrom(65536)
+        except KeyboardInterrupt:
+            break
+        if len(packet) == JACKTRIP_EXIT_PACKET_SIZE:
+            blocks.pop(sender, None)
+            continue
+        parsed = parse(packet)
+        packets += 1
+        bytes_in += len(packet)
+        if parsed is None:
+            print(f'Unexpected packet of {len(packet)} bytes from {sender[0]}:{sender[1]}')
+            continue
+
+        fields, first, total, data = parsed
+        block = blocks.get(sender)
+        if block and block[0][1] != fields[1]:
+            # Anything still missing from the previous block is silent.
+            flush(sender)
+            block = None
+        if block is None:
+            block = blocks[sender] = (fields, [None] * total, [False] * total)
+        _, channels, received = block
+        channels[first:first + len(data)] = data
+        received[first:first + len(data)] = [True] * len(data)
+        if all(received):
+            flush(sender)
+
+        now = time.monotonic()
+        if now - last_report >= 1:
+            saving = 100 * (1 - bytes_in / bytes_out) if bytes_out else 0
+            print(f'{packets / (now - last_report):.0f} packets/s, {8e-3 * bytes_in / (now - last_report):.0f} kbit/s '
+                  f'in, {8e-3 * bytes_out / (now - last_report):.0f} kbit/s expanded ({saving:.0f}% saved); '
+                  f'{silent} of {channels_seen} channels silent')
+            bytes_in = bytes_out = packets = silent = channels_seen = 0
+            last_report = now
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+
+"""
+Sends a wide, multichannel JackTrip audio stream to a UDP multicast group, for
+JackTripClients set up via setMulticast() to receive their own channels from.
+Channel n carries a sine tone of (n + 1) * --frequency Hz.
+
+With --adpcm, sends IMA-ADPCM-coded audio (see adpcm.py) rather than 16-bit
+PCM. This is for testing the decoder, not for streaming: the encoder is pure
+Python, and only keeps up with real time for a handful of channels (about four,
+at 32 samples per packet), beyond which packets go out late. With --mtu, splits packets that wouldn't fit the MTU into several, each
+carrying some of the channels, as JackTripClient::setMtu() does.
+
+Timestamps count samples sent, in microseconds since the epoch, so are on the
+same clock as scripts/clock-sync-responder.py run on the same host, as
+JackTripClient::setSynchronisedPlayout() requires. With --sawtooth, channel 0
+instead carries the unipolar sawtooth expected by the sync-tester example,
+rising by one per sample from 0 to 32767, in phase with the timestamps: each
+sample's value is its time, in samples since the epoch, modulo 32768.
+
+With --listen, instead joins the group and reports the level of each channel
+received, e.g. to test on the loopback interface:
+
+  ./multicast-sender.py --interface 127.0.0.1 &
+  ./multicast-sender.py --interface 127.0.0.1 --listen
+"""
+
+import argparse
+import math
+import socket
+import struct
+import time
+
+import adpcm
+
+# JackTripPacketHeader: TimeStamp, SeqNumber, BufferSize, SamplingRate,
+# BitResolution, NumIncomingChannelsFromNet, NumOutgoingChannelsToNet.
+HEADER = struct.Struct('<QHHBBBB')
+# Split packets: BitResolution flag, and the header that follows
+# JackTripPacketHeader: FirstChannel, TotalChannels.
+SUB_STREAM_FLAG = 0x40
+SUB_STREAM_HEADER = struct.Struct('<BB')
+IP_UDP_HEADER_SIZE = 28
+SAMPLING_RATES = {22050: 0, 32000: 1, 44100: 2, 48000: 3, 88200: 4, 96000: 5, 192000: 6}
+
+
+def open_socket(args, listen):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    interface = socket.inet_aton(args.interface)
+    if listen:
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        sock.bind(('', args.port))
+        membership = socket.inet_aton(args.group) + interface
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    else:
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, interface)
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, args.ttl)
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+    return sock
+
+
+def send(args):
+    sock = open_socket(args, listen=False)
+    period = args.buffer_size / args.rate
+    phases = [0.] * args.channels
+    increments = [2 * math.pi * (ch + 1) * args.frequency / args.rate for ch in range(args.channels)]
+    sequence = 0
+    behind = False
+    start = time.monotonic()
+    # Samples since the epoch at the first sample sent.
+    first_sample = time.time_ns() * args.rate // 1_000_000_000
+    print(f'Sending {args.channels} channels to {args.group}:{args.port} '
+          f'({args.buffer_size} samples at {args.rate} Hz)')
+
+    while True:
+        sample = first_sample + sequence * args.buffer_size
+        timestamp = sample * 1_000_000 // args.rate
+        bits = adpcm.BIT_RESOLUTION if args.adpcm else 16
+        channels = []
+        for ch in range(args.channels):
+            samples = []
+            for n in range(args.buffer_size):
+                if args.sawtooth and ch == 0:
+                    samples.append((sample + n) % 32768)
+                    continue
+                samples.append(int(args.amplitude * 32767 * math.sin(phases[ch])))
+                phases[ch] = (phases[ch] + increments[ch]) % (2 * math.pi)
+            channels.append(adpcm.encode(samples) if args.adpcm else struct.pack(f'<{args.buffer_size}h', *samples))
+
+        per_packet = args.channels
+        size = IP_UDP_HEADER_SIZE + HEADER.size + sum(len(c) for c in channels)
+        if args.mtu and size > args.mtu:
+            room = args.mtu - IP_UDP_HEADER_SIZE - HEADER.size - SUB_STREAM_HEADER.size
+            per_packet = max(1, room // len(channels[0]))
+        for first in range(0, args.channels, per_packet):
+            group = channels[first:first + per_packet]
+            split = per_packet < args.channels
+            header = HEADER.pack(timestamp, sequence & 0xffff, args.buffer_size, SAMPLING_RATES[args.rate],
+                                 bits | SUB_STREAM_FLAG if split else bits, len(group), 0)
+            if split:
+                header += SUB_STREAM_HEADER.pack(first, args.channels)
+            sock.sendto(header + b''.join(group), (args.group, args.port))
+
+        sequence += 1
+        delay = start + sequence * period - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+        elif delay < -1 and not behind:
+            print('Falling behind real time; try fewer channels')
+            behind = True
+
+
+def listen(args):
+    sock = open_socket(args, listen=True)
+    print(f'Listening on {args.group}:{args.port}')
+    last_report = time.monotonic()
+    packets = 0
+    # Sequence number and channel levels of the block being reported, which
+    # may arrive split across several packets.
+    report_sequence = None
+    levels = []
+
+    while True:
+        packet = sock.recv(65536)
+        packets += 1
+        now = time.monotonic()
+        if report_sequence is None and now - last_report < 1:
+            continue
+
+        _, sequence, buffer_size, _, bits, channels, _ = HEADER.unpack_from(packet)
+        offset = HEADER.size
+        first, total = 0, channels
+        if bits & SUB_STREAM_FLAG:
+            first, total = SUB_STREAM_HEADER.unpack_from(packet, offset)
+            offset += SUB_STREAM_HEADER.size
+            bits &= ~SUB_STREAM_FLAG
+        channel_size = adpcm.channel_bytes(buffer_size) if bits == adpcm.BIT_RESOLUTION else buffer_size * 2
+        if (bits not in (16, adpcm.BIT_RESOLUTION) or len(packet) != offset + channels * channel_size
+                or first + channels > total):
+            print(f'Unexpected packet of {len(packet)} bytes')
+            continue
+
+        if sequence != report_sequence:
+            report_sequence = sequence
+            levels = [None] * total
+        for ch in range(first, first + channels):
+            if bits == adpcm.BIT_RESOLUTION:
+                samples = adpcm.decode(packet[offset:offset + channel_size], buffer_size)
+            else:
+                samples = struct.unpack_from(f'<{buffer_size}h', packet, offset)
+            offset += channel_size
+            rms = math.sqrt(sum(s * s for s in samples) / buffer_size)
+            levels[ch] = f'{20 * math.log10(max(rms, 1) / 32768):.0f}'
+        if None in levels:
+            continue
+
+        print(f'{packets / (now - last_report):.0f} packets/s, seq {sequence}, dBFS: {" ".join(levels)}')
+        last_report = now
+        packets = 0
+        report_sequence = None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--group', default='239.1.2.3', help='multicast group address')
+    parser.add_argument('--port', type=int, default=61002, help='UDP port')
+    parser.add_argument('--interface', default='0.0.0.0', help='address of the interface to use')
+    parser.add_argument('--channels', type=int, default=32, help='channels in the stream')
+    parser.add_argument('--buffer-size', type=int, default=32, help='samples per channel per packet')
+    parser.add_argument('--rate', type=int, default=44100, choices=SAMPLING_RATES.keys(), help='sampling rate')
+    parser.add_argument('--frequency', type=float, default=110., help='tone spacing in Hz')
+    parser.add_argument('--amplitude', type=float, default=.25, help='tone amplitude, 0 to 1')
+    parser.add_argument('--adpcm', action='store_true', help='send IMA-ADPCM rather than 16-bit PCM, for testing only')
+    parser.add_argument('--sawtooth', action='store_true', help='send the sync-tester sawtooth on channel 0')
+    parser.add_argument('--mtu', type=int, default=0, help='split packets to fit this MTU; 0 not to')
+    parser.add_argument('--ttl', type=int, default=1, help='multicast time-to-live')
+    parser.add_argument('--listen', action='store_true', help='receive rather than send')
+    args = parser.parse_args()
+
+    try:
+        listen(args) if args.listen else send(args)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
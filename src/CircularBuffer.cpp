@@ -5,7 +5,7 @@
 #include "CircularBuffer.h"
 
 template<typename T>
-CircularBuffer<T>::CircularBuffer(uint16_t length) :
+CircularBuffer<T>::CircularBuffer(uint32_t length) :
         length{length},
         buffer{new T[length]} {
     clear();
@@ -50,40 +50,57 @@ void CircularBuffer<T>::printStats() {
 }
 
 template<typename T>
-void CircularBuffer<T>::write(const T *data, uint16_t len) {
-    for (int i = 0; i < len; ++i, ++writeIndex) {
-        if (writeIndex == length) {
-            writeIndex = 0;
-        }
+void CircularBuffer<T>::write(const T *data, uint32_t len) {
+    auto spans{writableSpans(len)};
+    memcpy(spans.first.data, data, spans.first.length * sizeof(T));
+    memcpy(spans.second.data, data + spans.first.length, spans.second.length * sizeof(T));
+    commitWrite(len);
+}
 
-        buffer[writeIndex] = data[i];
-    }
+template<typename T>
+void CircularBuffer<T>::read(T *bufferToFill, uint32_t len) {
+    auto spans{readableSpans(len)};
+    memcpy(bufferToFill, spans.first.data, spans.first.length * sizeof(T));
+    memcpy(bufferToFill + spans.first.length, spans.second.data, spans.second.length * sizeof(T));
+    commitRead(len);
+}
 
-    ++numWrites;
-//    if (lastOp == WRITE) {
-//        ++consecutiveOpCount;
-//        Serial.printf("CircularBuffer: Extra WRITE (%d)\n", consecutiveOpCount);
-//    } else {
-//        consecutiveOpCount = 1;
-//    }
-//    lastOp = WRITE;
+template<typename T>
+typename CircularBuffer<T>::Spans CircularBuffer<T>::writableSpans(uint32_t len) {
+    return getSpans(writeIndex, len);
 }
 
 template<typename T>
-void CircularBuffer<T>::read(T *bufferToFill, uint16_t len) {
-    for (int i = 0; i < len; ++i, ++readIndex) {
-        if (readIndex == length) {
-            readIndex = 0;
-        }
-        bufferToFill[i] = buffer[readIndex];
-    }
+typename CircularBuffer<T>::Spans CircularBuffer<T>::readableSpans(uint32_t len) {
+    return getSpans(readIndex, len);
+}
+
+template<typename T>
+void CircularBuffer<T>::commitWrite(uint32_t len) {
+    writeIndex = advance(writeIndex, len);
+    ++numWrites;
+}
 
+template<typename T>
+void CircularBuffer<T>::commitRead(uint32_t len) {
+    readIndex = advance(readIndex, len);
     ++numReads;
-//    if (lastOp == READ) {
-//        ++consecutiveOpCount;
-//        Serial.printf("CircularBuffer: Extra READ (%d)\n", consecutiveOpCount);
-//    } else {
-//        consecutiveOpCount = 1;
-//    }
-//    lastOp = READ;
+}
+
+template<typename T>
+typename CircularBuffer<T>::Spans CircularBuffer<T>::getSpans(uint32_t index, uint32_t len) {
+    auto firstLength{min(len, length - index)};
+    return Spans{
+            Span{buffer + index, firstLength},
+            Span{buffer, len - firstLength}
+    };
+}
+
+template<typename T>
+uint32_t CircularBuffer<T>::advance(uint32_t index, uint32_t len) {
+    auto next{index + len};
+    if (next >= length) {
+        next -= length;
+    }
+    return next;
 }
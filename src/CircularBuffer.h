@@ -10,13 +10,53 @@
 template<typename T>
 class CircularBuffer {
 public:
-    explicit CircularBuffer(uint16_t length);
+    /**
+     * A contiguous region of the buffer.
+     */
+    struct Span {
+        T *data;
+        uint32_t length;
+    };
+
+    /**
+     * Up to two contiguous regions which together make up a requested number
+     * of elements; second is empty unless the request wraps around the end of
+     * the buffer.
+     */
+    struct Spans {
+        Span first;
+        Span second;
+    };
+
+    explicit CircularBuffer(uint32_t length);
 
     ~CircularBuffer();
 
-    void write(const T *data, uint16_t len);
+    void write(const T *data, uint32_t len);
+
+    void read(T *bufferToFill, uint32_t len);
 
-    void read(T *bufferToFill, uint16_t len);
+    /**
+     * Get direct access to the next len elements to be written. Call
+     * commitWrite() once they have been filled.
+     */
+    Spans writableSpans(uint32_t len);
+
+    /**
+     * Get direct access to the next len elements to be read. Call
+     * commitRead() once they have been consumed.
+     */
+    Spans readableSpans(uint32_t len);
+
+    /**
+     * Advance the write index past elements filled via writableSpans().
+     */
+    void commitWrite(uint32_t len);
+
+    /**
+     * Advance the read index past elements consumed via readableSpans().
+     */
+    void commitRead(uint32_t len);
 
     int getWriteIndex();
 
@@ -33,10 +73,14 @@ private:
         WRITE
     };
     const uint32_t kStatInterval{2500};
-    uint16_t length;
+    uint32_t length;
     T *buffer;
-    uint16_t writeIndex{0}, readIndex{0};
+    uint32_t writeIndex{0}, readIndex{0};
     int32_t numReads{0}, numWrites{0};
+    Spans getSpans(uint32_t index, uint32_t len);
+
+    uint32_t advance(uint32_t index, uint32_t len);
+
     OperationType lastOp{UNKNOWN};
     uint8_t consecutiveOpCount{1};
     elapsedMillis statTimer;
@@ -4,29 +4,46 @@
 
 #include "CircularBufferMulti.h"
 
+/**
+ * Cubic Lagrange interpolation coefficients, for fractional read positions
+ * quantised to 2^INTERPOLATION_TABLE_BITS phases. The extra row, for
+ * alpha = 1, saves handling a carry when rounding to the nearest phase.
+ * Shared by all instances and held in DTCM.
+ */
+static float cubicTable[(1 << INTERPOLATION_TABLE_BITS) + 1][4];
+static bool cubicTableReady{false};
+
 template<typename T>
-CircularBufferMulti<T>::CircularBufferMulti(uint8_t numChannels, uint16_t length, DebugMode debugMode) :
+CircularBufferMulti<T>::CircularBufferMulti(uint8_t numChannels,
+                                            uint16_t length,
+                                            DriftMode driftMode,
+                                            DebugMode debugMode) :
         kNumChannels{numChannels},
-        kLength{length},
-        kFloatLength{static_cast<float>(length)},
-        kRwDeltaThresh(kFloatLength * .15f, kFloatLength * .45f),
+        kCapacity{length},
+        kDriftMode{driftMode},
         buffer{new T *[numChannels]},
         debugMode{debugMode} {
 
     for (int ch = 0; ch < kNumChannels; ++ch) {
-        buffer[ch] = new T[kLength];
+        buffer[ch] = new T[kCapacity];
     }
 
-    clear();
-
-    if (debugMode == DebugMode::RW_DELTA_VISUALISER) {
-        // Set up the rw-delta visualiser.
-        memset(visualiser, '-', VISUALISER_LENGTH);
-        auto normLoThresh = static_cast<int>(roundf(100.f * (1.f - (kRwDeltaThresh.first / kFloatLength))));
-        auto normHiThresh = static_cast<int>(roundf(100.f * (1.f - (kRwDeltaThresh.second / kFloatLength))));
-        visualiser[normLoThresh] = '<';
-        visualiser[normHiThresh] = '>';
+    if (!cubicTableReady) {
+        for (int p = 0; p <= TABLE_PHASES; ++p) {
+            auto alpha{static_cast<float>(p) / static_cast<float>(TABLE_PHASES)};
+            cubicTable[p][0] = -alpha * (alpha - 1.f) * (alpha - 2.f) / 6.f;
+            cubicTable[p][1] = (alpha - 1.f) * (alpha + 1.f) * (alpha - 2.f) / 2.f;
+            cubicTable[p][2] = -alpha * (alpha + 1.f) * (alpha - 2.f) / 2.f;
+            cubicTable[p][3] = alpha * (alpha + 1.f) * (alpha - 1.f) / 6.f;
+        }
+        cubicTableReady = true;
     }
+
+    // Outside the audio path, so may take its time.
+    SincTable::prepare();
+    sincTable = SincTable::acquire(1.f);
+
+    setLength(length);
 }
 
 template<typename T>
@@ -35,6 +52,7 @@ CircularBufferMulti<T>::~CircularBufferMulti() {
         delete buffer[i];
     }
     delete[] buffer;
+    SincTable::release(sincTable);
 }
 
 template<typename T>
@@ -50,19 +68,202 @@ float CircularBufferMulti<T>::getReadPosition() {
 template<typename T>
 void CircularBufferMulti<T>::clear() {
     for (int ch = 0; ch < kNumChannels; ++ch) {
-        for (int s = 0; s < kLength; ++s) {
+        for (int s = 0; s < length; ++s) {
             buffer[ch][s] = 0;
         }
     }
 
-    readPos = kFloatLength * .25f;
-    writeIndex = 0;
+    readPos = floatLength * .25f;
+    writeIndex.store(0);
+    samplesWritten.store(0);
     numBlockReads = 0;
     numBlockWrites = 0;
     numSampleWrites = 0;
     numSampleReads = 0;
     readPosAllTime = 0.f;
     readPosIncrement.set(1., true);
+    driftRatio = nominalRatio;
+    meanIncrement = nominalRatio;
+    samplesConsumed = 0.;
+    samplesReadSinceLastUpdate = 0;
+    samplesWrittenAtLastUpdate = 0;
+
+    priming = Priming{};
+    primedRatio = nominalRatio;
+    primed.store(false);
+    haveSchedule = false;
+    scheduleError = 0.f;
+    interpolationCrossfadeRemaining = 0;
+    locked = false;
+    targetDelay = 0.f;
+    primedJitter = 0.f;
+    skipCrossfadeRemaining = 0;
+    catchUpRequest.store(CatchUp::NONE, std::memory_order_relaxed);
+    catchUpSkipped.store(0, std::memory_order_relaxed);
+    numSkips = 0;
+    slip = 0.f;
+    numInsertions = 0;
+    numDeletions = 0;
+}
+
+template<typename T>
+void CircularBufferMulti<T>::requestReset(uint16_t newLength, float newNominalRatio) {
+    // Keep anything asked for by an earlier request not yet taken up.
+    if (newLength > 0) {
+        requestedLength.store(newLength, std::memory_order_relaxed);
+    }
+    if (newNominalRatio > 0.f) {
+        requestedNominalRatio.store(newNominalRatio, std::memory_order_relaxed);
+    }
+    resetRequested.fetch_add(1, std::memory_order_release);
+}
+
+template<typename T>
+void CircularBufferMulti<T>::setLength(uint16_t newLength) {
+    length = constrain(newLength, static_cast<uint16_t>(1), kCapacity);
+    floatLength = static_cast<float>(length);
+    rwDeltaThresh = std::make_pair(floatLength * .15f, floatLength * .45f);
+
+    if (debugMode == DebugMode::RW_DELTA_VISUALISER) {
+        // Set up the rw-delta visualiser.
+        memset(visualiser, '-', VISUALISER_LENGTH);
+        auto normLoThresh = static_cast<int>(roundf(100.f * (1.f - (rwDeltaThresh.first / floatLength))));
+        auto normHiThresh = static_cast<int>(roundf(100.f * (1.f - (rwDeltaThresh.second / floatLength))));
+        visualiser[normLoThresh] = '<';
+        visualiser[normHiThresh] = '>';
+    }
+
+    clear();
+}
+
+template<typename T>
+uint16_t CircularBufferMulti<T>::getLength() const {
+    return length;
+}
+
+template<typename T>
+void CircularBufferMulti<T>::setPrimingLength(uint16_t numWrites) {
+    primingLength = max(numWrites, static_cast<uint16_t>(2));
+}
+
+template<typename T>
+bool CircularBufferMulti<T>::isPrimed() const {
+    return primed.load(std::memory_order_acquire);
+}
+
+template<typename T>
+void CircularBufferMulti<T>::setInterpolation(Interpolation newInterpolation) {
+    requestedInterpolation.store(newInterpolation, std::memory_order_relaxed);
+}
+
+template<typename T>
+typename CircularBufferMulti<T>::Interpolation CircularBufferMulti<T>::getInterpolation() const {
+    return requestedInterpolation.load(std::memory_order_relaxed);
+}
+
+template<typename T>
+void CircularBufferMulti<T>::updateInterpolation() {
+    auto requested{requestedInterpolation.load(std::memory_order_relaxed)};
+    if (requested == interpolation) {
+        return;
+    }
+
+    // Only crossfade if actually reading audio; start a new crossfade from
+    // whatever is currently being heard.
+    if (locked && !readsWholeFrames()) {
+        if (interpolationCrossfadeRemaining == 0) {
+            previousInterpolation = interpolation;
+        }
+        interpolationCrossfadeRemaining = INTERPOLATION_CROSSFADE_LENGTH;
+    }
+    interpolation = requested;
+}
+
+template<typename T>
+void CircularBufferMulti<T>::setNominalRatio(float ratio) {
+    SincTable::request(ratio);
+    nominalRatio = ratio;
+    driftRatio = ratio;
+    primedRatio = ratio;
+    meanIncrement = ratio;
+    readPosIncrement.set(ratio, true);
+    fixedIncrement = false;
+}
+
+template<typename T>
+void CircularBufferMulti<T>::setFixedIncrement(float increment) {
+    SincTable::request(increment);
+    if (!fixedIncrement) {
+        meanIncrement = increment;
+    }
+    nominalRatio = increment;
+    driftRatio = increment;
+    primedRatio = increment;
+    readPosIncrement.set(increment, !fixedIncrement);
+    fixedIncrement = true;
+}
+
+template<typename T>
+float CircularBufferMulti<T>::getMeanIncrement() const {
+    return meanIncrement;
+}
+
+template<typename T>
+double CircularBufferMulti<T>::getSamplesConsumed() const {
+    return samplesConsumed;
+}
+
+template<typename T>
+void CircularBufferMulti<T>::setScheduledPlayout(bool enable) {
+    scheduledPlayout = enable;
+    haveSchedule = false;
+}
+
+template<typename T>
+void CircularBufferMulti<T>::setPlayoutTime(uint32_t playoutTime, float samplesPerMicro) {
+    auto sequence{sharedSchedule.sequence.load(std::memory_order_relaxed)};
+    sharedSchedule.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    sharedSchedule.index.store(lastWriteIndex, std::memory_order_relaxed);
+    sharedSchedule.time.store(playoutTime, std::memory_order_relaxed);
+    sharedSchedule.rate.store(samplesPerMicro, std::memory_order_relaxed);
+    sharedSchedule.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+template<typename T>
+uint16_t CircularBufferMulti<T>::getNumReadable() {
+    if (!isPrimed()) {
+        return 0;
+    }
+
+    if (!locked) {
+        lock();
+    }
+
+    auto readable{(getReadWriteDelta() - getLookAhead()) / readPosIncrement.getCurrent()};
+    return readable > 0.f ? static_cast<uint16_t>(readable) : 0;
+}
+
+template<typename T>
+void CircularBufferMulti<T>::setMaxLatency(float maxDelta) {
+    maxLatency.store(max(maxDelta, 0.f), std::memory_order_relaxed);
+}
+
+template<typename T>
+float CircularBufferMulti<T>::getMaxLatency() const {
+    auto maxDelta{maxLatency.load(std::memory_order_relaxed)};
+    return maxDelta < 0.f ? floatLength * .75f : maxDelta;
+}
+
+template<typename T>
+void CircularBufferMulti<T>::requestCatchUp(bool crossfade, float minExcess) {
+    catchUpMinExcess.store(minExcess, std::memory_order_relaxed);
+    catchUpRequest.store(crossfade ? CatchUp::CROSSFADE : CatchUp::CUT, std::memory_order_release);
+}
+
+template<typename T>
+uint32_t CircularBufferMulti<T>::takeCatchUpSkipped() {
+    return catchUpSkipped.exchange(0, std::memory_order_relaxed);
 }
 
 template<typename T>
@@ -85,84 +286,188 @@ void CircularBufferMulti<T>::printStats() {
                       fSampleWrites - readPosAllTime,
                       fSampleWrites / readPosAllTime);
 
-        Serial.printf("CircularBuffer: writeIndex: %d, readPos: %f, delta %f\n\n",
-                      writeIndex, readPos, getReadWriteDelta());
+        Serial.printf("CircularBuffer: writeIndex: %d, readPos: %f, delta %f\n",
+                      writeIndex.load(), readPos, getReadWriteDelta());
+
+        if (haveSchedule) {
+            Serial.printf("CircularBuffer: scheduled playout, error %f samples\n", scheduleError);
+        }
+        Serial.printf("CircularBuffer: primed: %s, jitter %f, target delay %f, drift ratio %.7f, skips %" PRIu32 "\n\n",
+                      isPrimed() ? "yes" : "no", primedJitter, targetDelay, driftRatio, numSkips);
+
+        if (kDriftMode == DriftMode::INSERT_DELETE) {
+            Serial.printf("CircularBuffer: frames inserted %" PRIu32 ", deleted %" PRIu32 "\n\n",
+                          numInsertions, numDeletions);
+        }
         statTimer = 0;
     }
 }
 
 template<typename T>
-void CircularBufferMulti<T>::write(const T **data, uint16_t len) {
-    for (int n = 0; n < len; ++n, ++writeIndex, ++numSampleWrites) {
-        if (writeIndex == kLength) {
-            writeIndex = 0;
-        }
+void CircularBufferMulti<T>::write(const T **data, uint16_t len, uint64_t timestamp) {
+    // Leave the buffer alone until the reader has reset it.
+    if (resetRequested.load(std::memory_order_relaxed) != resetDone.load(std::memory_order_acquire)) {
+        return;
+    }
 
+    auto w{writeIndex.load(std::memory_order_relaxed)};
+    lastWriteIndex = w;
+    for (int n = 0; n < len; ++n) {
         for (int ch = 0; ch < kNumChannels; ++ch) {
-            buffer[ch][writeIndex] = data[ch][n];
+            buffer[ch][w] = data[ch][n];
+        }
+        if (++w == length) {
+            w = 0;
         }
     }
+    writeIndex.store(w, std::memory_order_release);
 
+    numSampleWrites += len;
     ++numBlockWrites;
-    ++blocksWrittenSinceLastUpdate;
+    samplesWritten.fetch_add(len, std::memory_order_relaxed);
 
-    if (lastOp == WRITE) {
-        ++consecutiveOpCount;
-//        Serial.printf("CircularBuffer: Extra WRITE (%d)\n", consecutiveOpCount);
-    } else {
-        consecutiveOpCount = 1;
+    if (!primed.load(std::memory_order_relaxed)) {
+        prime(len, timestamp);
     }
-    lastOp = WRITE;
 }
 
 template<typename T>
 void CircularBufferMulti<T>::read(T **bufferToFill, uint16_t len) {
-    auto initialReadPos{readPos};
+    auto requested{resetRequested.load(std::memory_order_acquire)};
+    if (requested != resetDone.load(std::memory_order_relaxed)) {
+        auto newRatio{requestedNominalRatio.exchange(0.f, std::memory_order_relaxed)};
+        if (newRatio > 0.f) {
+            setNominalRatio(newRatio);
+        }
+        auto newLength{requestedLength.exchange(0, std::memory_order_relaxed)};
+        if (newLength > 0) {
+            setLength(newLength);
+        } else {
+            clear();
+        }
+        resetDone.store(requested, std::memory_order_release);
+    }
+
+    updateInterpolation();
+
+    // Play silence until arrival rate and jitter are known.
+    if (!isPrimed()) {
+        for (int ch = 0; ch < kNumChannels; ++ch) {
+            memset(bufferToFill[ch], 0, len * sizeof(T));
+        }
+        return;
+    }
+
+    if (!locked) {
+        lock();
+    }
+
+    if (scheduledPlayout) {
+        followSchedule(len);
+    }
+
+    auto catchUp{catchUpRequest.exchange(CatchUp::NONE, std::memory_order_acquire)};
+    if (catchUp != CatchUp::NONE && !haveSchedule) {
+        auto rwDelta{getReadWriteDelta()};
+        auto excess{rwDelta - targetDelay};
+        if (excess > catchUpMinExcess.load(std::memory_order_relaxed)) {
+            skipAhead(rwDelta);
+            catchUpSkipped.fetch_add(static_cast<uint32_t>(roundf(excess)), std::memory_order_relaxed);
+            if (catchUp == CatchUp::CUT) {
+                skipCrossfadeRemaining = 0;
+            }
+        }
+    }
 
+    updateSincTable();
+
+    readAdvance = 0.f;
+    if (readsWholeFrames()) {
+        readInsertDelete(bufferToFill, len);
+    } else {
+        readInterpolated(bufferToFill, len);
+    }
+    meanIncrement += MEAN_INCREMENT_SMOOTHING * (readAdvance / static_cast<float>(len) - meanIncrement);
+    samplesConsumed += readAdvance;
+
+    ++numBlockReads;
+    samplesReadSinceLastUpdate += len;
+
+    setReadPosIncrement();
+}
+
+template<typename T>
+bool CircularBufferMulti<T>::readsWholeFrames() const {
+    return kDriftMode == DriftMode::INSERT_DELETE && nominalRatio == 1.f;
+}
+
+template<typename T>
+void CircularBufferMulti<T>::readInterpolated(T **bufferToFill, uint16_t len) {
+    auto maxDelta{getMaxLatency()};
     for (uint16_t n = 0; n < len; n++) {
         // Wrap readPos.
-        if (readPos >= kFloatLength) {
-            readPos -= kFloatLength;
+        if (readPos >= floatLength) {
+            readPos -= floatLength;
+        }
+
+        // Try to keep read position a consistent, safe distance behind write
+        // index.
+        auto rwDelta{getReadWriteDelta()};
+
+        // Beyond the latency cap, don't wait for the increment to catch up.
+        if (!haveSchedule && maxDelta > 0.f && rwDelta > maxDelta && skipCrossfadeRemaining == 0) {
+            skipAhead(rwDelta);
+            rwDelta = getReadWriteDelta();
         }
 
         float readIdx{0.f};
         auto alpha = modff(readPos, &readIdx);
         // For each channel, get the next sample, interpolated around readPos.
         for (int ch = 0; ch < kNumChannels; ++ch) {
-            bufferToFill[ch][n] = interpolateCubic(buffer[ch], static_cast<uint16_t>(readIdx), alpha);
+            bufferToFill[ch][n] = interpolate(interpolation, buffer[ch], static_cast<uint16_t>(readIdx), alpha);
         }
 
-        // Try to keep read position a consistent, safe distance behind write
-        // index.
-        auto rwDelta{getReadWriteDelta()};
-
-        if (rwDelta < kRwDeltaThresh.first) {
-            readPosIncrement.set(rwDelta / kRwDeltaThresh.first, true);
-
-//            Serial.printf(
-//                    "Read %" PRId64 " < loThresh behind write (readPos: %f, writeIndex: %d, rwDelta: %f, last+: %f)\n",
-//                    numSampleReads, readPos, writeIndex, getReadWriteDelta(),increment);
-//                    numSampleReads, readPos, writeIndex, getReadWriteDelta(), readPosIncrement.getCurrent());
-        } else if (rwDelta > kRwDeltaThresh.second) {
-            readPosIncrement.set(rwDelta / kRwDeltaThresh.second);
+        // Fade in from the previous interpolation method.
+        if (interpolationCrossfadeRemaining > 0) {
+            auto gain{static_cast<float>(interpolationCrossfadeRemaining) /
+                      static_cast<float>(INTERPOLATION_CROSSFADE_LENGTH + 1)};
+            for (int ch = 0; ch < kNumChannels; ++ch) {
+                auto from{static_cast<float>(
+                                  interpolate(previousInterpolation, buffer[ch], static_cast<uint16_t>(readIdx), alpha))};
+                auto to{static_cast<float>(bufferToFill[ch][n])};
+                bufferToFill[ch][n] = static_cast<T>(roundf(to + gain * (from - to)));
+            }
+            --interpolationCrossfadeRemaining;
+        }
 
-//            Serial.printf(
-//                    "Read %" PRId64 " > hiThresh behind write (readPos: %f, writeIndex: %d, rwDelta: %f, last+: %f)\n",
-//                    numSampleReads, readPos, writeIndex, getReadWriteDelta(), increment);
-//                    numSampleReads, readPos, writeIndex, getReadWriteDelta(), readPosIncrement.getCurrent());
-        } else {
-            readPosIncrement.set(1.f);
+        // Fade in from the pre-skip read position.
+        if (skipCrossfadeRemaining > 0) {
+            if (skipFromPos >= floatLength) {
+                skipFromPos -= floatLength;
+            }
+            alpha = modff(skipFromPos, &readIdx);
+            auto gain{static_cast<float>(skipCrossfadeRemaining) / static_cast<float>(SKIP_CROSSFADE_LENGTH + 1)};
+            for (int ch = 0; ch < kNumChannels; ++ch) {
+                auto from{static_cast<float>(interpolate(interpolation, buffer[ch], static_cast<uint16_t>(readIdx), alpha))};
+                auto to{static_cast<float>(bufferToFill[ch][n])};
+                bufferToFill[ch][n] = static_cast<T>(roundf(to + gain * (from - to)));
+            }
+            skipFromPos += readPosIncrement.getCurrent();
+            --skipCrossfadeRemaining;
         }
 
+        updateReadPosIncrement(rwDelta);
+
         auto increment{readPosIncrement.getNext()};
 //        Serial.printf("readPos increment %f\n", increment);
         readPos += increment;
         readPosAllTime += increment;
+        readAdvance += increment;
         ++numSampleReads;
 
         // Visualise the state of the read-write delta.
         if (debugMode == DebugMode::RW_DELTA_VISUALISER && n % 8 == 0) {
-            auto r{static_cast<int>(roundf(100.f * (1.f - (rwDelta / kFloatLength))))};
+            auto r{static_cast<int>(roundf(100.f * (1.f - (rwDelta / floatLength))))};
             auto temp{visualiser[r]};
             visualiser[r] = '#';
             Serial.printf("%s %f (+%f)\n", visualiser, rwDelta, increment);
@@ -170,24 +475,107 @@ void CircularBufferMulti<T>::read(T **bufferToFill, uint16_t len) {
         }
     }
 
-    // Just do a wavetable thing if there haven't yet been any writes.
-    if (0 == numBlockWrites) {
-        readPos = initialReadPos;
-        readPosAllTime = 0.;
-    } else {
-        ++numBlockReads;
-        ++blocksReadSinceLastUpdate;
+}
+
+template<typename T>
+void CircularBufferMulti<T>::readInsertDelete(T **bufferToFill, uint16_t len) {
+    auto rwDelta{getReadWriteDelta()};
+
+    auto maxDelta{getMaxLatency()};
+    if (!haveSchedule && maxDelta > 0.f && rwDelta > maxDelta && skipCrossfadeRemaining == 0) {
+        skipAhead(rwDelta);
+        rwDelta = getReadWriteDelta();
     }
 
-    if (lastOp == READ) {
-        ++consecutiveOpCount;
-//        Serial.printf("CircularBuffer: Extra READ (%d)\n", consecutiveOpCount);
+    // Accumulate the difference between the ideal, fractional read position
+    // and the integer one actually used; once that reaches a whole frame,
+    // drop or repeat a frame to make it up.
+    updateReadPosIncrement(rwDelta);
+    // Step the smoothed increment once per sample, as readInterpolated()
+    // does, so that it settles at the same rate.
+    for (uint16_t n = 0; n < len; ++n) {
+        slip += readPosIncrement.getNext() - 1.f;
+    }
+    int shift{0};
+    if (slip >= 1.f) {
+        shift = 1;
+        slip -= 1.f;
+        ++numDeletions;
+    } else if (slip <= -1.f) {
+        shift = -1;
+        slip += 1.f;
+        ++numInsertions;
+    }
+
+    auto r{static_cast<uint16_t>(readPos)};
+
+    if (shift == 0 || len <= CORRECTION_CROSSFADE_LENGTH) {
+        for (int ch = 0; ch < kNumChannels; ++ch) {
+            copyFrom(buffer[ch], r, bufferToFill[ch], len);
+        }
+        shift = 0;
     } else {
-        consecutiveOpCount = 1;
+        // Hide the correction at the quietest frame in the block, crossfading
+        // from the unshifted signal to the shifted one.
+        auto m{findQuietestFrame(r, len - CORRECTION_CROSSFADE_LENGTH)};
+        auto resume{static_cast<uint16_t>(wrapIndex(r + m + CORRECTION_CROSSFADE_LENGTH + shift, length))};
+        for (int ch = 0; ch < kNumChannels; ++ch) {
+            copyFrom(buffer[ch], r, bufferToFill[ch], m);
+            for (int i = 0; i < CORRECTION_CROSSFADE_LENGTH; ++i) {
+                auto gain{static_cast<float>(i + 1) / static_cast<float>(CORRECTION_CROSSFADE_LENGTH + 1)};
+                auto from{static_cast<float>(buffer[ch][wrapIndex(r + m + i, length)])};
+                auto to{static_cast<float>(buffer[ch][wrapIndex(r + m + i + shift, length)])};
+                bufferToFill[ch][m + i] = static_cast<T>(roundf(from + gain * (to - from)));
+            }
+            copyFrom(buffer[ch], resume, bufferToFill[ch] + m + CORRECTION_CROSSFADE_LENGTH,
+                     len - m - CORRECTION_CROSSFADE_LENGTH);
+        }
     }
-    lastOp = READ;
 
-    setReadPosIncrement();
+    // Fade in from the pre-skip read position.
+    if (skipCrossfadeRemaining > 0) {
+        auto from{static_cast<uint16_t>(skipFromPos)};
+        for (uint16_t n = 0; n < len && skipCrossfadeRemaining > 0; ++n, --skipCrossfadeRemaining) {
+            auto gain{static_cast<float>(skipCrossfadeRemaining) / static_cast<float>(SKIP_CROSSFADE_LENGTH + 1)};
+            auto idx{wrapIndex(from + n, length)};
+            for (int ch = 0; ch < kNumChannels; ++ch) {
+                auto to{static_cast<float>(bufferToFill[ch][n])};
+                bufferToFill[ch][n] = static_cast<T>(roundf(to + gain * (static_cast<float>(buffer[ch][idx]) - to)));
+            }
+        }
+        skipFromPos = static_cast<float>(wrapIndex(from + len, length));
+    }
+
+    auto advance{static_cast<float>(len + shift)};
+    readPos = static_cast<float>(wrapIndex(r + len + shift, length));
+    readPosAllTime += advance;
+    readAdvance += advance;
+    numSampleReads += len;
+}
+
+template<typename T>
+void CircularBufferMulti<T>::updateReadPosIncrement(float rwDelta) {
+    if (fixedIncrement) {
+        readPosIncrement.set(driftRatio);
+    } else if (haveSchedule) {
+        readPosIncrement.set(scheduledIncrement);
+    } else if (rwDelta < rwDeltaThresh.first) {
+        readPosIncrement.set(driftRatio * rwDelta / rwDeltaThresh.first, true);
+
+//        Serial.printf(
+//                "Read %" PRId64 " < loThresh behind write (readPos: %f, writeIndex: %d, rwDelta: %f, last+: %f)\n",
+//                numSampleReads, readPos, writeIndex, getReadWriteDelta(),increment);
+//                numSampleReads, readPos, writeIndex, getReadWriteDelta(), readPosIncrement.getCurrent());
+    } else if (rwDelta > rwDeltaThresh.second) {
+        readPosIncrement.set(driftRatio * rwDelta / rwDeltaThresh.second);
+
+//        Serial.printf(
+//                "Read %" PRId64 " > hiThresh behind write (readPos: %f, writeIndex: %d, rwDelta: %f, last+: %f)\n",
+//                numSampleReads, readPos, writeIndex, getReadWriteDelta(), increment);
+//                numSampleReads, readPos, writeIndex, getReadWriteDelta(), readPosIncrement.getCurrent());
+    } else {
+        readPosIncrement.set(driftRatio);
+    }
 }
 
 template<typename T>
@@ -196,45 +584,322 @@ void CircularBufferMulti<T>::setReadPosIncrement() {
 //    readPosIncrement.set(increment);
 //    return;
 
-    // Update the read increment every N blocks, based on the ratio of writes
-    // to reads during that period.
-    if (blocksReadSinceLastUpdate > 0 && blocksWrittenSinceLastUpdate >= BLOCKS_PER_READ_INCREMENT_UPDATE) {
-        auto nextIncrement{static_cast<float>(blocksWrittenSinceLastUpdate) /
-                           static_cast<float>(blocksReadSinceLastUpdate)};
+    // Update the read increment every N samples, based on the ratio of
+    // samples written to samples read during that period. Counting samples
+    // rather than blocks allows writes and reads to differ in length.
+    auto written{samplesWritten.load(std::memory_order_relaxed)};
+    auto samplesWrittenSinceLastUpdate{written - samplesWrittenAtLastUpdate};
+    if (!fixedIncrement && samplesReadSinceLastUpdate > 0 &&
+        samplesWrittenSinceLastUpdate >= SAMPLES_PER_READ_INCREMENT_UPDATE) {
+        auto nextIncrement{static_cast<float>(samplesWrittenSinceLastUpdate) /
+                           static_cast<float>(samplesReadSinceLastUpdate)};
+
+        driftRatio = nextIncrement;
+        readPosIncrement.set(driftRatio);
+
+        samplesReadSinceLastUpdate = 0;
+        samplesWrittenAtLastUpdate = written;
+    }
+}
+
+template<typename T>
+void CircularBufferMulti<T>::prime(uint16_t len, uint64_t timestamp) {
+    auto now{micros()};
+
+    if (priming.numWrites == 0) {
+        priming.firstArrival = now;
+        priming.firstTimestamp = timestamp;
+    } else {
+        // Time by which this write should have followed the first, according
+        // to the sender's timestamps if available, or to the nominal sampling
+        // rate otherwise.
+        auto expected = timestamp > priming.firstTimestamp && priming.firstTimestamp != 0
+                        ? static_cast<int32_t>(timestamp - priming.firstTimestamp)
+                        : static_cast<int32_t>(1e6f * static_cast<float>(priming.numSamples) /
+                                               (nominalRatio * AUDIO_SAMPLE_RATE_EXACT));
+        auto lateness{static_cast<int32_t>(now - priming.firstArrival) - expected};
+        if (lateness < priming.minLateness) {
+            priming.minLateness = lateness;
+        } else if (lateness > priming.maxLateness) {
+            priming.maxLateness = lateness;
+        }
+    }
+
+    if (timestamp != 0 && priming.firstTimestamp != 0) {
+        auto x{static_cast<double>(priming.numSamples)};
+        auto y{static_cast<double>(static_cast<int64_t>(timestamp - priming.firstTimestamp))};
+        ++priming.numTimestamps;
+        priming.sumSamples += x;
+        priming.sumTime += y;
+        priming.sumSamplesSquared += x * x;
+        priming.sumSamplesTime += x * y;
+    }
+
+    priming.numSamples += len;
+    priming.maxWriteLength = max(priming.maxWriteLength, len);
+
+    if (++priming.numWrites < primingLength) {
+        return;
+    }
+
+    // Seed the drift estimate with the sender's sampling rate, as measured by
+    // its own timestamps, relative to the local sampling rate. Fit a line to
+    // every timestamp in the window, rather than taking any one interval,
+    // which may be jittery.
+    auto n{static_cast<double>(priming.numTimestamps)};
+    auto denominator{n * priming.sumSamplesSquared - priming.sumSamples * priming.sumSamples};
+    if (priming.numTimestamps >= 2 && denominator > 0.) {
+        auto microsPerSample{(n * priming.sumSamplesTime - priming.sumSamples * priming.sumTime) / denominator};
+        if (microsPerSample > 0.) {
+            auto ratio{static_cast<float>(1e6 / microsPerSample) / AUDIO_SAMPLE_RATE_EXACT};
+            if (!fixedIncrement && fabsf(ratio / nominalRatio - 1.f) < MAX_PRIMED_DRIFT) {
+                primedRatio = ratio;
+            }
+        }
+    }
+
+    primedJitter = static_cast<float>(priming.maxLateness - priming.minLateness) *
+                   nominalRatio * AUDIO_SAMPLE_RATE_EXACT / 1e6f;
+    targetDelay = static_cast<float>(priming.maxWriteLength) + JITTER_HEADROOM * primedJitter + 2.f * getLookAhead();
+    targetDelay = constrain(targetDelay, rwDeltaThresh.first, rwDeltaThresh.second);
+    auto maxDelta{getMaxLatency()};
+    if (maxDelta > 0.f) {
+        targetDelay = min(targetDelay, maxDelta);
+    }
+
+    primed.store(true, std::memory_order_release);
+}
 
-//        Serial.printf("blocks read per %d writes: %d, nextIncrement: %.7f\n",
-//                      blocksWrittenSinceLastUpdate,
-//                      blocksReadSinceLastUpdate,
-//                      nextIncrement);
+template<typename T>
+void CircularBufferMulti<T>::lock() {
+    readPos = static_cast<float>(writeIndex.load(std::memory_order_acquire)) - targetDelay;
+    if (readPos < 0.f) {
+        readPos += floatLength;
+    }
+    driftRatio = primedRatio;
+    readPosIncrement.set(driftRatio, true);
+    readPosAllTime = 0.f;
+    samplesReadSinceLastUpdate = 0;
+    samplesWrittenAtLastUpdate = samplesWritten.load(std::memory_order_relaxed);
+    locked = true;
+}
 
-        readPosIncrement.set(nextIncrement);
+template<typename T>
+void CircularBufferMulti<T>::skipAhead(float rwDelta) {
+    // The latency cap may have been lowered below the target delay since
+    // priming; don't jump backwards.
+    auto maxDelta{getMaxLatency()};
+    auto target{maxDelta > 0.f ? min(targetDelay, maxDelta) : targetDelay};
+    if (rwDelta > target) {
+        skip(rwDelta - target);
+    }
+}
 
-        blocksReadSinceLastUpdate = 0;
-        blocksWrittenSinceLastUpdate = 0;
+template<typename T>
+void CircularBufferMulti<T>::skip(float numSamples) {
+    if (readsWholeFrames()) {
+        numSamples = roundf(numSamples);
+    }
+    skipFromPos = readPos;
+    readPos += numSamples;
+    if (readPos >= floatLength) {
+        readPos -= floatLength;
+    } else if (readPos < 0.f) {
+        readPos += floatLength;
     }
+    readPosAllTime += numSamples;
+    samplesConsumed += numSamples;
+    skipCrossfadeRemaining = SKIP_CROSSFADE_LENGTH;
+    ++numSkips;
+}
+
+template<typename T>
+void CircularBufferMulti<T>::followSchedule(uint16_t len) {
+    // Take the writer's latest schedule, unless it's mid-update.
+    auto sequence{sharedSchedule.sequence.load(std::memory_order_acquire)};
+    if (sequence != 0 && (sequence & 1) == 0) {
+        Schedule latest{sharedSchedule.index.load(std::memory_order_relaxed),
+                        sharedSchedule.time.load(std::memory_order_relaxed),
+                        sharedSchedule.rate.load(std::memory_order_relaxed)};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sharedSchedule.sequence.load(std::memory_order_relaxed) == sequence) {
+            schedule = latest;
+            haveSchedule = true;
+        }
+    }
+
+    if (!haveSchedule) {
+        return;
+    }
+
+    // The position that should be read now, relative to the current one.
+    auto elapsed{static_cast<float>(static_cast<int32_t>(micros() - schedule.time))};
+    auto error{static_cast<float>(schedule.index) + elapsed * schedule.rate - readPos};
+    if (error >= floatLength * .5f) {
+        error -= floatLength;
+    } else if (error < -floatLength * .5f) {
+        error += floatLength;
+    }
+
+    // Neither read past the write index, nor back into what may already have
+    // been overwritten.
+    auto rwDelta{getReadWriteDelta()};
+    auto increment{schedule.rate * 1e6f / AUDIO_SAMPLE_RATE_EXACT};
+    auto latest{rwDelta - getLookAhead() - increment * static_cast<float>(len)};
+    auto earliest{rwDelta - floatLength + static_cast<float>(len)};
+    error = constrain(error, earliest, max(latest, 0.f));
+    scheduleError = error;
+
+    if (fabsf(error) > MAX_SCHEDULE_ERROR && skipCrossfadeRemaining == 0) {
+        skip(error);
+        error = 0.f;
+    }
+
+    scheduledIncrement = increment * (1.f + SCHEDULE_CORRECTION * error);
 }
 
 template<typename T>
 float CircularBufferMulti<T>::getReadWriteDelta() {
-    auto fWrite{static_cast<float>(writeIndex)};
+    auto fWrite{static_cast<float>(writeIndex.load(std::memory_order_acquire))};
     if (readPos > fWrite) {
-        return fWrite + kFloatLength - readPos;
+        return fWrite + floatLength - readPos;
     } else {
         return fWrite - readPos;
     }
 }
 
 
+template<typename T>
+T CircularBufferMulti<T>::interpolate(Interpolation method, T *channelData, uint16_t readIdx, float alpha) {
+    switch (method) {
+        case Interpolation::NONE:
+            return channelData[readIdx];
+        case Interpolation::LINEAR:
+            return interpolateLinear(channelData, readIdx, alpha);
+        case Interpolation::CUBIC_TABLE:
+            return interpolateTable(channelData, readIdx, alpha);
+        case Interpolation::SINC:
+            return interpolateSinc(channelData, readIdx, alpha);
+        case Interpolation::CUBIC:
+        default:
+            return interpolateCubic(channelData, readIdx, alpha);
+    }
+}
+
+template<typename T>
+T CircularBufferMulti<T>::interpolateLinear(T *channelData, uint16_t readIdx, float alpha) {
+    auto a{static_cast<float>(channelData[readIdx])};
+    auto b{static_cast<float>(channelData[readIdx == length - 1 ? 0 : readIdx + 1])};
+    return static_cast<T>(roundf(a + alpha * (b - a)));
+}
+
+template<typename T>
+T CircularBufferMulti<T>::interpolateTable(T *channelData, uint16_t readIdx, float alpha) {
+    int r{readIdx};
+    auto rm{r - 1}, rp{r + 1}, rpp{r + 2};
+    if (r == 0) {
+        rm = length - 1;
+    } else if (r == length - 2) {
+        rpp = 0;
+    } else if (r == length - 1) {
+        rp = 0;
+        rpp = 1;
+    }
+    auto c = cubicTable[static_cast<int>(alpha * TABLE_PHASES + .5f)];
+    auto val = static_cast<float>(channelData[rm]) * c[0]
+               + static_cast<float>(channelData[r]) * c[1]
+               + static_cast<float>(channelData[rp]) * c[2]
+               + static_cast<float>(channelData[rpp]) * c[3];
+
+    return static_cast<T>(roundf(val));
+}
+
+template<typename T>
+T CircularBufferMulti<T>::interpolateSinc(T *channelData, uint16_t readIdx, float alpha) {
+    // All channels share a read position, so only recompute coefficients
+    // when it changes.
+    if (alpha != sincAlpha) {
+        auto phase{alpha * SINC_PHASES};
+        auto p{static_cast<int>(phase)};
+        auto frac{phase - static_cast<float>(p)};
+        auto row{sincTable + p * SINC_TAPS}, nextRow{row + SINC_TAPS};
+        for (int j = 0; j < SINC_TAPS; ++j) {
+            sincCoeffs[j] = row[j] + frac * (nextRow[j] - row[j]);
+        }
+        sincAlpha = alpha;
+    }
+
+    auto start{static_cast<int>(readIdx) - (SINC_TAPS / 2 - 1)};
+    auto val{0.f};
+    if (start >= 0 && start + SINC_TAPS <= length) {
+        auto x{channelData + start};
+        for (int j = 0; j < SINC_TAPS; ++j) {
+            val += static_cast<float>(x[j]) * sincCoeffs[j];
+        }
+    } else {
+        for (int j = 0; j < SINC_TAPS; ++j) {
+            val += static_cast<float>(channelData[wrapIndex(start + j, length)]) * sincCoeffs[j];
+        }
+    }
+
+    return static_cast<T>(roundf(val));
+}
+
+template<typename T>
+void CircularBufferMulti<T>::updateSincTable() {
+    auto ratio{nominalRatio};
+    if (ratio == sincTableRatio) {
+        return;
+    }
+    auto table{SincTable::acquire(ratio)};
+    SincTable::release(sincTable);
+    if (table != sincTable) {
+        sincTable = table;
+        sincAlpha = -1.f;
+    }
+    // Until the table for a decimating ratio has been built, keep looking,
+    // and asking, in case releasing the old one has freed a slot.
+    if (ratio <= 1.f || table != SincTable::acquire(1.f)) {
+        sincTableRatio = ratio;
+    } else {
+        SincTable::request(ratio);
+    }
+}
+
+template<typename T>
+float CircularBufferMulti<T>::getLookAhead() const {
+    if (readsWholeFrames()) {
+        return 1.f;
+    }
+    auto lookAhead{getLookAhead(interpolation)};
+    if (interpolationCrossfadeRemaining > 0) {
+        lookAhead = max(lookAhead, getLookAhead(previousInterpolation));
+    }
+    return lookAhead;
+}
+
+template<typename T>
+float CircularBufferMulti<T>::getLookAhead(Interpolation method) const {
+    switch (method) {
+        case Interpolation::NONE:
+            return 1.f;
+        case Interpolation::SINC:
+            return static_cast<float>(SINC_TAPS / 2);
+        default:
+            return 2.f;
+    }
+}
+
 template<typename T>
 T CircularBufferMulti<T>::interpolateCubic(T *channelData, uint16_t readIdx, float alpha) {
 //    return channelData[readIdx];
     int r{readIdx};
     auto rm{r - 1}, rp{r + 1}, rpp{r + 2};
     if (r == 0) {
-        rm = kLength - 1;
-    } else if (r == kLength - 2) {
+        rm = length - 1;
+    } else if (r == length - 2) {
         rpp = 0;
-    } else if (r == kLength - 1) {
+    } else if (r == length - 1) {
         rp = 0;
         rpp = 1;
     }
@@ -247,7 +912,7 @@ T CircularBufferMulti<T>::interpolateCubic(T *channelData, uint16_t readIdx, flo
 }
 
 template<typename T>
-uint16_t CircularBufferMulti<T>::wrapIndex(uint16_t index, uint16_t length) {
+int CircularBufferMulti<T>::wrapIndex(int index, uint16_t length) {
     if (index >= length) {
         index -= length;
     } else if (index < 0) {
@@ -255,3 +920,30 @@ uint16_t CircularBufferMulti<T>::wrapIndex(uint16_t index, uint16_t length) {
     }
     return index;
 }
+
+template<typename T>
+void CircularBufferMulti<T>::copyFrom(const T *channelData, uint16_t start, T *dest, uint16_t len) {
+    auto firstPart{min(len, static_cast<uint16_t>(length - start))};
+    memcpy(dest, channelData + start, firstPart * sizeof(T));
+    if (firstPart < len) {
+        memcpy(dest + firstPart, channelData, (len - firstPart) * sizeof(T));
+    }
+}
+
+template<typename T>
+uint16_t CircularBufferMulti<T>::findQuietestFrame(uint16_t start, uint16_t len) {
+    uint16_t quietest{0};
+    auto minEnergy{UINT32_MAX};
+    for (uint16_t n = 0; n <= len; ++n) {
+        auto idx{wrapIndex(start + n, length)};
+        uint32_t energy{0};
+        for (int ch = 0; ch < kNumChannels; ++ch) {
+            energy += abs(buffer[ch][idx]);
+        }
+        if (energy < minEnergy) {
+            minEnergy = energy;
+            quietest = n;
+        }
+    }
+    return quietest;
+}
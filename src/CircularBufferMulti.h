@@ -7,8 +7,29 @@
 
 
 #include <Arduino.h>
+#include <AudioStream.h>
+#include <atomic>
+#include "SincTable.h"
 #include "SmoothedParameter.h"
 
+/**
+ * log2 of the number of fractional phases in the table used by
+ * Interpolation::CUBIC_TABLE. The table occupies
+ * 16 * (2^INTERPOLATION_TABLE_BITS + 1) bytes.
+ */
+#ifndef INTERPOLATION_TABLE_BITS
+#define INTERPOLATION_TABLE_BITS 8
+#endif
+
+/**
+ * Multichannel circular buffer with a fractional read position.
+ * Single-producer, single-consumer: write() may run in a different interrupt
+ * context from read() and getNumReadable(), the writer publishing its index
+ * atomically and each side owning its own statistics. Everything else,
+ * clear() and the setters included, should be called while neither is
+ * running, unless documented otherwise; requestReset() changes the length
+ * and nominal ratio while reading.
+ */
 template<typename T>
 class CircularBufferMulti {
 public:
@@ -17,11 +38,71 @@ public:
         RW_DELTA_VISUALISER,
     };
 
-    CircularBufferMulti(uint8_t numChannels, uint16_t length, DebugMode debugMode = DebugMode::NONE);
+    enum class DriftMode {
+        /**
+         * Read at a fractional position, with cubic interpolation.
+         */
+        INTERPOLATE,
+        /**
+         * Read at an integer position with plain copies; correct drift by
+         * occasionally dropping or repeating a frame. That corrects at most a
+         * frame per read, so while the nominal ratio isn't 1, i.e. while
+         * converting sampling rates, read as INTERPOLATE instead.
+         */
+        INSERT_DELETE,
+    };
+
+    /**
+     * Interpolation methods, in order of increasing quality and cost.
+     */
+    enum class Interpolation {
+        /**
+         * No interpolation; read the sample at or before the read position.
+         */
+        NONE,
+        /**
+         * Linear interpolation between the two nearest samples.
+         */
+        LINEAR,
+        /**
+         * Cubic Lagrange interpolation, with the fractional read position
+         * quantised to 2^INTERPOLATION_TABLE_BITS phases and coefficients
+         * looked up from a precomputed table.
+         */
+        CUBIC_TABLE,
+        /**
+         * Cubic Lagrange interpolation, evaluated at every sample.
+         */
+        CUBIC,
+        /**
+         * Windowed-sinc interpolation via a polyphase filter, band-limited
+         * according to the nominal read increment; suitable for converting
+         * between sampling rates. When decimating, the band-limited table is
+         * built by SincTable::prepare(), which must be called from loop();
+         * until then, reads aren't band-limited.
+         */
+        SINC,
+    };
+
+    /**
+     * @param length capacity of the buffer, in samples per channel; see
+     * setLength().
+     */
+    CircularBufferMulti(uint8_t numChannels,
+                        uint16_t length,
+                        DriftMode driftMode = DriftMode::INTERPOLATE,
+                        DebugMode debugMode = DebugMode::NONE);
 
     ~CircularBufferMulti();
 
-    void write(const T **data, uint16_t len);
+    /**
+     * Write a block of samples to the buffer.
+     * @param data one array of samples per channel.
+     * @param len number of samples per channel.
+     * @param timestamp sender's timestamp for the block, in microseconds, if
+     * known. Used to estimate the sender's sampling rate while priming.
+     */
+    void write(const T **data, uint16_t len, uint64_t timestamp = 0);
 
     void read(T **bufferToFill, uint16_t len);
 
@@ -31,43 +112,440 @@ public:
 
     void clear();
 
+    /**
+     * Ask the reader to clear the buffer at its next read, first setting its
+     * length and nominal ratio if given. May be called from the writer's
+     * context, or any other, while the reader is running; writes are dropped
+     * until the reader has done so.
+     * @param newLength see setLength(); 0 to keep the current length.
+     * @param newNominalRatio see setNominalRatio(); 0 to keep the current
+     * ratio.
+     */
+    void requestReset(uint16_t newLength = 0, float newNominalRatio = 0.f);
+
     void printStats();
 
+    /**
+     * Set the length of the buffer, up to the capacity given on construction,
+     * and clear it. The read-write delta thresholds, and the default maximum
+     * latency, scale with the length, so it should be a similar multiple of
+     * the length of each write whatever that is.
+     */
+    void setLength(uint16_t newLength);
+
+    uint16_t getLength() const;
+
+    /**
+     * Set the number of writes over which to measure arrival jitter, and the
+     * sender's rate, before placing the read position. The read position is
+     * placed far enough behind the write index to absorb the jitter seen in
+     * that time; it doesn't allow for worse jitter later, which the
+     * read-write delta thresholds must deal with. Takes effect on the next
+     * clear().
+     * @param numWrites
+     */
+    void setPrimingLength(uint16_t numWrites);
+
+    bool isPrimed() const;
+
+    /**
+     * Set the read-write delta beyond which the read position jumps forward
+     * to the target delay, rather than gradually catching up. The target
+     * delay is capped at this. May be called from any context.
+     * @param maxDelta maximum read-write delta, in samples; 0 to disable.
+     */
+    void setMaxLatency(float maxDelta);
+
+    /**
+     * Ask the reader to jump to the target delay at its next read, if it has
+     * fallen further behind, e.g. once a backlog of packets has arrived in a
+     * burst after a network stall. May be called from the writer's context.
+     * Ignored while following a playout schedule.
+     * @param crossfade whether to crossfade from the old read position.
+     * @param minExcess samples by which the read-write delta must exceed the
+     * target delay for the reader to jump.
+     */
+    void requestCatchUp(bool crossfade, float minExcess = 0.f);
+
+    /**
+     * Get the number of samples skipped by catch-ups since last called, and
+     * reset it. May be called from the writer's context.
+     */
+    uint32_t takeCatchUpSkipped();
+
+    /**
+     * Set the interpolation method used by DriftMode::INTERPOLATE. May be
+     * called while reading, from any context; the reader crossfades from the
+     * old method to the new one at its next read.
+     */
+    void setInterpolation(Interpolation newInterpolation);
+
+    Interpolation getInterpolation() const;
+
+    /**
+     * Set the expected ratio of write rate to read rate, e.g. 48000/44117.647
+     * to read at Teensy's sampling rate from a buffer written at 48 kHz.
+     * Drift is then estimated relative to this ratio. Call before writing, or
+     * after clear().
+     */
+    void setNominalRatio(float ratio);
+
+    /**
+     * Read at a fixed increment, rather than adjusting the increment to keep
+     * the read-write delta within thresholds. For a reader that reads only
+     * when getNumReadable() permits, e.g. to convert a stream to a different
+     * sampling rate. The first call takes effect immediately; subsequent
+     * calls are smoothed, so the increment may be updated continuously, e.g.
+     * to follow another buffer's getMeanIncrement().
+     * @param increment write rate to read rate.
+     */
+    void setFixedIncrement(float increment);
+
+    /**
+     * Get the read increment actually applied, averaged over roughly the last
+     * 1/MEAN_INCREMENT_SMOOTHING reads, excluding skips. Since the read-write
+     * delta is held within bounds, this follows the ratio of the writer's
+     * clock to the reader's more finely than the block-count drift estimate.
+     */
+    float getMeanIncrement() const;
+
+    /**
+     * Get the number of written samples that have been read, or skipped, since
+     * the buffer was last cleared. Since the read-write delta is bounded, this
+     * tracks the number of samples written, without the jitter of arrivals.
+     */
+    double getSamplesConsumed() const;
+
+    /**
+     * Read according to the schedule given by setPlayoutTime(), rather than
+     * keeping the read-write delta within thresholds.
+     */
+    void setScheduledPlayout(bool enable);
+
+    /**
+     * Schedule the first sample of the most recent write to be read at a
+     * given local time. Call from the writer, after write().
+     * @param playoutTime value of micros() at which to read the sample.
+     * @param samplesPerMicro rate, in written samples per local microsecond,
+     * at which the samples that follow should be read.
+     */
+    void setPlayoutTime(uint32_t playoutTime, float samplesPerMicro);
+
+    /**
+     * Get the number of samples that can be read, at the current increment,
+     * without reading past the write index.
+     */
+    uint16_t getNumReadable();
+
 private:
-    enum OperationType {
-        UNKNOWN,
-        READ,
-        WRITE
-    };
-    static constexpr uint16_t BLOCKS_PER_READ_INCREMENT_UPDATE{1000};
+    /**
+     * Samples written between updates of the drift estimate.
+     */
+    static constexpr uint32_t SAMPLES_PER_READ_INCREMENT_UPDATE{1000 * AUDIO_BLOCK_SAMPLES};
     static constexpr uint8_t VISUALISER_LENGTH{100};
+    static constexpr uint16_t DEFAULT_PRIMING_LENGTH{64};
+    /**
+     * Largest deviation from unity permitted for the read increment derived
+     * while priming. Anything beyond this is probably a bad measurement.
+     */
+    static constexpr float MAX_PRIMED_DRIFT{.005f};
+    /**
+     * Headroom, as a multiple of peak-to-peak arrival jitter, to leave between
+     * read position and write index when priming.
+     */
+    static constexpr float JITTER_HEADROOM{1.5f};
+    static constexpr int SINC_TAPS{SincTable::TAPS};
+    static constexpr int SINC_PHASES{SincTable::PHASES};
+    /**
+     * Per-read smoothing coefficient for getMeanIncrement().
+     */
+    static constexpr float MEAN_INCREMENT_SMOOTHING{.001f};
+    /**
+     * Deviation, in samples, from the scheduled read position beyond which to
+     * jump rather than correct gradually.
+     */
+    static constexpr float MAX_SCHEDULE_ERROR{64.f};
+    /**
+     * Relative change in read increment per sample of deviation from the
+     * scheduled read position.
+     */
+    static constexpr float SCHEDULE_CORRECTION{1.f / 16384.f};
+    /**
+     * Length, in samples, of the crossfade between old and new read positions
+     * when skipping ahead.
+     */
+    static constexpr uint16_t SKIP_CROSSFADE_LENGTH{32};
+    /**
+     * Length, in samples, of the crossfade used to hide a dropped or repeated
+     * frame in insert/delete mode.
+     */
+    static constexpr uint16_t CORRECTION_CROSSFADE_LENGTH{8};
+    /**
+     * Length, in samples, of the crossfade between interpolation methods.
+     */
+    static constexpr uint16_t INTERPOLATION_CROSSFADE_LENGTH{64};
+    static constexpr int TABLE_PHASES{1 << INTERPOLATION_TABLE_BITS};
     const uint32_t kStatInterval{2500};
     const uint8_t kNumChannels;
-    const uint16_t kLength;
-    const float kFloatLength;
-    const std::pair<float, float> kRwDeltaThresh;
+    const uint16_t kCapacity;
+    const DriftMode kDriftMode;
+    uint16_t length{0};
+    float floatLength{0.f};
+    std::pair<float, float> rwDeltaThresh;
 
     float getReadWriteDelta();
 
     void setReadPosIncrement();
 
+    /**
+     * Set the read increment required to keep the read-write delta within
+     * thresholds.
+     */
+    void updateReadPosIncrement(float rwDelta);
+
+    /**
+     * Whether to read whole frames, per DriftMode::INSERT_DELETE, rather
+     * than interpolate.
+     */
+    bool readsWholeFrames() const;
+
+    void readInterpolated(T **bufferToFill, uint16_t len);
+
+    void readInsertDelete(T **bufferToFill, uint16_t len);
+
+    /**
+     * Copy len samples from a channel of the ring, starting at start, to dest.
+     */
+    void copyFrom(const T *channelData, uint16_t start, T *dest, uint16_t len);
+
+    /**
+     * Find the frame, from start to start + len inclusive, with the lowest
+     * total magnitude across all channels.
+     * @return offset of the quietest frame relative to start.
+     */
+    uint16_t findQuietestFrame(uint16_t start, uint16_t len);
+
+    /**
+     * Measure arrival rate and jitter during priming.
+     */
+    void prime(uint16_t len, uint64_t timestamp);
+
+    /**
+     * Place the read position at the delay determined during priming.
+     */
+    void lock();
+
+    /**
+     * Jump the read position forward to the target delay, crossfading from
+     * the old read position.
+     */
+    float getMaxLatency() const;
+
+    void skipAhead(float rwDelta);
+
+    /**
+     * Move the read position by some number of samples, crossfading from the
+     * old read position.
+     */
+    void skip(float numSamples);
+
+    /**
+     * Get the latest schedule from the writer and set the read increment, or
+     * jump, to follow it.
+     */
+    void followSchedule(uint16_t len);
+
+    /**
+     * Take up any change of interpolation method requested by
+     * setInterpolation().
+     */
+    void updateInterpolation();
+
+    T interpolate(Interpolation method, T *channelData, uint16_t readIdx, float alpha);
+
+    T interpolateLinear(T *channelData, uint16_t readIdx, float alpha);
+
     T interpolateCubic(T *channelData, uint16_t readIdx, float alpha);
 
-    uint16_t wrapIndex(uint16_t index, uint16_t length);
+    T interpolateTable(T *channelData, uint16_t readIdx, float alpha);
+
+    T interpolateSinc(T *channelData, uint16_t readIdx, float alpha);
+
+    /**
+     * Take up the shared sinc table for the nominal ratio, once
+     * SincTable::prepare() has built it.
+     */
+    void updateSincTable();
+
+    /**
+     * Get the number of samples beyond the read position that the current
+     * interpolator reads.
+     */
+    float getLookAhead() const;
+
+    float getLookAhead(Interpolation method) const;
+
+    int wrapIndex(int index, uint16_t length);
 
     T **buffer;
-    uint16_t writeIndex{0};
+
+    // Shared: written only by the writer, read by both.
+    /**
+     * Index to which the next sample will be written; published after the
+     * samples preceding it.
+     */
+    std::atomic<uint16_t> writeIndex{0};
+    /**
+     * Samples written since clear(), wrapping; the reader measures drift from
+     * the difference between snapshots.
+     */
+    std::atomic<uint32_t> samplesWritten{0};
+    /**
+     * Set once the writer has finished priming; publishes targetDelay,
+     * primedJitter and primedRatio.
+     */
+    std::atomic<bool> primed{false};
+    /**
+     * Latest playout schedule, guarded by a sequence number that is odd while
+     * the writer is updating it. The reader never waits; if it catches the
+     * writer mid-update it keeps its previous copy.
+     */
+    struct {
+        std::atomic<uint32_t> sequence{0};
+        std::atomic<uint16_t> index{0};
+        std::atomic<uint32_t> time{0};
+        std::atomic<float> rate{0.f};
+    } sharedSchedule;
+
+    enum class CatchUp : uint8_t {
+        NONE,
+        CROSSFADE,
+        CUT
+    };
+    /**
+     * Catch-up requested by the writer, to be taken up by the reader.
+     */
+    std::atomic<CatchUp> catchUpRequest{CatchUp::NONE};
+    /**
+     * Excess over the target delay required by the latest catch-up request;
+     * published by catchUpRequest.
+     */
+    std::atomic<float> catchUpMinExcess{0.f};
+    /**
+     * Samples skipped by catch-ups, added to by the reader and taken by
+     * takeCatchUpSkipped().
+     */
+    std::atomic<uint32_t> catchUpSkipped{0};
+    /**
+     * Incremented by each requestReset(), whose length and ratio, if any,
+     * it publishes.
+     */
+    std::atomic<uint32_t> resetRequested{0};
+    /**
+     * The value of resetRequested at the reader's latest reset; publishes
+     * the reset state to the writer.
+     */
+    std::atomic<uint32_t> resetDone{0};
+    std::atomic<uint16_t> requestedLength{0};
+    std::atomic<float> requestedNominalRatio{0.f};
+
+    // Writer-owned.
+    uint64_t numBlockWrites{0}, numSampleWrites{0};
+    uint16_t lastWriteIndex{0};
+    /**
+     * Ratio of write rate to read rate measured while priming.
+     */
+    float primedRatio{1.f};
+
+    // Reader-owned.
     float readPos{0.f};
     SmoothedParameter<float> readPosIncrement{1.f};
-    uint64_t numBlockReads{0}, numBlockWrites{0}, numSampleWrites{0}, numSampleReads{0};
-    uint32_t blocksReadSinceLastUpdate{0}, blocksWrittenSinceLastUpdate{0};
+    /**
+     * Long-term ratio of write rate to read rate.
+     */
+    float driftRatio{1.f};
+    uint64_t numBlockReads{0}, numSampleReads{0};
+    uint32_t samplesReadSinceLastUpdate{0};
+    /**
+     * Value of samplesWritten at the last drift estimate.
+     */
+    uint32_t samplesWrittenAtLastUpdate{0};
     float readPosAllTime{0.f};
-    OperationType lastOp{UNKNOWN};
-    uint8_t consecutiveOpCount{1};
+    struct Schedule {
+        uint16_t index{0};
+        uint32_t time{0};
+        float rate{0.f};
+    };
+    bool scheduledPlayout{false};
+    Schedule schedule;
+    bool haveSchedule{false};
+    float scheduledIncrement{1.f};
+    float scheduleError{0.f};
     elapsedMillis statTimer{0};
     elapsedMillis debugTimer{100};
     char visualiser[VISUALISER_LENGTH + 1]{};
     DebugMode debugMode{DebugMode::NONE};
+    std::atomic<Interpolation> requestedInterpolation{Interpolation::CUBIC};
+    Interpolation interpolation{Interpolation::CUBIC};
+    Interpolation previousInterpolation{Interpolation::CUBIC};
+    uint16_t interpolationCrossfadeRemaining{0};
+    float nominalRatio{1.f};
+    bool fixedIncrement{false};
+    /**
+     * (SINC_PHASES + 1) rows of SINC_TAPS coefficients, shared with other
+     * buffers; see SincTable.
+     */
+    const float *sincTable;
+    /**
+     * Coefficients for the most recent fractional read position, shared by
+     * all channels.
+     */
+    float sincCoeffs[SINC_TAPS]{};
+    float sincAlpha{-1.f};
+    /**
+     * Nominal ratio for which sincTable was built, once it has been.
+     */
+    float sincTableRatio{1.f};
+    float meanIncrement{1.f};
+    double samplesConsumed{0.};
+    /**
+     * Sum of read increments over the current read, excluding skips.
+     */
+    float readAdvance{0.f};
+
+    struct Priming {
+        uint16_t numWrites{0};
+        uint32_t numSamples{0};
+        uint16_t maxWriteLength{0};
+        uint32_t firstArrival{0};
+        uint64_t firstTimestamp{0};
+        /**
+         * Sums for a least-squares fit of timestamp against samples written,
+         * over the writes that have timestamps.
+         */
+        uint16_t numTimestamps{0};
+        double sumSamples{0.}, sumTime{0.}, sumSamplesSquared{0.}, sumSamplesTime{0.};
+        int32_t minLateness{0}, maxLateness{0};
+    };
+    uint16_t primingLength{DEFAULT_PRIMING_LENGTH};
+    Priming priming;
+    bool locked{false};
+    float targetDelay{0.f};
+    float primedJitter{0.f};
+    /**
+     * Set via setMaxLatency(); negative, until then, to follow the length of
+     * the buffer. See getMaxLatency().
+     */
+    std::atomic<float> maxLatency{-1.f};
+    float skipFromPos{0.f};
+    uint16_t skipCrossfadeRemaining{0};
+    uint32_t numSkips{0};
+    /**
+     * Fractional frames by which an integer read position lags (positive) or
+     * leads (negative) the ideal read position.
+     */
+    float slip{0.f};
+    uint32_t numInsertions{0}, numDeletions{0};
 };
 
 template
@@ -0,0 +1,122 @@
+#include "ClockEstimator.h"
+
+ClockEstimator::ClockEstimator() {
+    reset();
+}
+
+void ClockEstimator::reset() {
+    started = false;
+    localElapsed = 0;
+    numMinima = 0;
+    nextMinimum = 0;
+    offset = 0.;
+    skew = 1.;
+    fitted = false;
+}
+
+void ClockEstimator::update(uint64_t remoteTime, uint32_t localTime) {
+    if (started) {
+        auto jump{static_cast<int64_t>(remoteTime - lastRemote)};
+        if (jump < -MAX_REMOTE_JUMP || jump > MAX_REMOTE_JUMP) {
+            reset();
+        }
+    }
+
+    if (!started) {
+        remoteOrigin = remoteTime;
+        localOrigin = localTime;
+        lastLocal = localTime;
+        windowStart = 0.;
+        windowMin = Point{0., 0.};
+        started = true;
+    }
+
+    localElapsed += localTime - lastLocal;
+    lastLocal = localTime;
+    lastRemote = remoteTime;
+
+    Point p{static_cast<double>(static_cast<int64_t>(remoteTime - remoteOrigin)),
+            static_cast<double>(localElapsed)};
+
+    // Until there's a fit, just follow the earliest arrival.
+    if (!fitted && p.local - skew * p.remote < offset) {
+        offset = p.local - skew * p.remote;
+    }
+
+    if (p.local - p.remote < windowMin.local - windowMin.remote) {
+        windowMin = p;
+    }
+
+    if (p.remote - windowStart >= WINDOW_LENGTH) {
+        minima[nextMinimum] = windowMin;
+        nextMinimum = (nextMinimum + 1) % NUM_WINDOWS;
+        if (numMinima < NUM_WINDOWS) {
+            ++numMinima;
+        }
+        fit();
+
+        windowStart = p.remote;
+        windowMin = p;
+    }
+}
+
+void ClockEstimator::fit() {
+    if (numMinima < 2) {
+        return;
+    }
+
+    // Work relative to the mean to keep the sums well-conditioned.
+    Point mean;
+    for (int i = 0; i < numMinima; ++i) {
+        mean.remote += minima[i].remote;
+        mean.local += minima[i].local;
+    }
+    mean.remote /= numMinima;
+    mean.local /= numMinima;
+
+    auto sxx{0.}, sxy{0.};
+    for (int i = 0; i < numMinima; ++i) {
+        auto dx{minima[i].remote - mean.remote};
+        sxx += dx * dx;
+        sxy += dx * (minima[i].local - mean.local);
+    }
+
+    if (sxx <= 0.) {
+        return;
+    }
+
+    auto slope{sxy / sxx};
+    if (fabs(slope - 1.) > MAX_SKEW) {
+        return;
+    }
+
+    skew = slope;
+    offset = mean.local - skew * mean.remote;
+    fitted = true;
+}
+
+bool ClockEstimator::isValid() const {
+    return started;
+}
+
+uint32_t ClockEstimator::toLocal(uint64_t remoteTime) const {
+    auto remote{static_cast<double>(static_cast<int64_t>(remoteTime - remoteOrigin))};
+    return localOrigin + static_cast<uint32_t>(static_cast<int64_t>(offset + skew * remote));
+}
+
+uint64_t ClockEstimator::toRemote(uint32_t localTime) const {
+    auto local{static_cast<double>(localElapsed) + static_cast<int32_t>(localTime - lastLocal)};
+    return remoteOrigin + static_cast<uint64_t>(static_cast<int64_t>((local - offset) / skew));
+}
+
+float ClockEstimator::getSkew() const {
+    return static_cast<float>(skew);
+}
+
+void ClockEstimator::printStats() {
+    if (started && statTimer > kStatInterval) {
+        Serial.printf("ClockEstimator: %s, skew %.1f ppm, offset %.0f µs (%d windows)\n",
+                      fitted ? "fitted" : "not fitted", (skew - 1.) * 1e6, offset, numMinima);
+        statTimer = 0;
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef JACKTRIP_TEENSY_CLOCKESTIMATOR_H
+#define JACKTRIP_TEENSY_CLOCKESTIMATOR_H
+
+#include "Arduino.h"
+
+/**
+ * Estimates the mapping from a remote clock, as given by the timestamps of
+ * received packets, to the local clock, micros(). Arrival times are the
+ * remote send times plus a network delay that is never less than some
+ * minimum, so the mapping is a line fitted to the earliest arrival in each of
+ * a series of windows: the offset absorbs the minimum delay, and the slope is
+ * the skew between the two clocks.
+ */
+class ClockEstimator {
+public:
+    ClockEstimator();
+
+    void reset();
+
+    /**
+     * Register the arrival of a packet.
+     * @param remoteTime remote time, in microseconds, at which the packet was
+     * sent.
+     * @param localTime value of micros() when the packet arrived.
+     */
+    void update(uint64_t remoteTime, uint32_t localTime);
+
+    bool isValid() const;
+
+    /**
+     * Get the local time, in terms of micros(), at which something sent at a
+     * given remote time would arrive with minimum network delay.
+     */
+    uint32_t toLocal(uint64_t remoteTime) const;
+
+    /**
+     * The inverse of toLocal(): get the remote time at which something
+     * arriving at a given local time with minimum network delay was sent.
+     * @param localTime a value of micros() no earlier than the latest
+     * arrival, give or take a few seconds.
+     */
+    uint64_t toRemote(uint32_t localTime) const;
+
+    /**
+     * Get the number of local microseconds per remote microsecond.
+     */
+    float getSkew() const;
+
+    void printStats();
+
+private:
+    /**
+     * Length, in remote microseconds, of the windows from which minimum
+     * arrival times are taken.
+     */
+    static constexpr uint32_t WINDOW_LENGTH{250'000};
+    /**
+     * Number of window minima to which to fit the mapping, i.e. four seconds'
+     * worth.
+     */
+    static constexpr uint8_t NUM_WINDOWS{16};
+    /**
+     * Largest plausible skew between two crystal oscillators; anything beyond
+     * this is treated as a bad fit.
+     */
+    static constexpr double MAX_SKEW{.001};
+    /**
+     * Remote time discontinuity, in microseconds, beyond which to assume the
+     * remote end has restarted and start again.
+     */
+    static constexpr int64_t MAX_REMOTE_JUMP{2'000'000};
+
+    struct Point {
+        double remote{0.}, local{0.};
+    };
+
+    /**
+     * Fit offset and skew to the window minima by least squares.
+     */
+    void fit();
+
+    bool started{false};
+    uint64_t remoteOrigin{0}, lastRemote{0};
+    uint32_t localOrigin{0}, lastLocal{0};
+    /**
+     * Local time since localOrigin, unwrapped.
+     */
+    uint64_t localElapsed{0};
+    double windowStart{0.};
+    Point windowMin;
+    Point minima[NUM_WINDOWS];
+    uint8_t numMinima{0}, nextMinimum{0};
+    double offset{0.}, skew{1.};
+    bool fitted{false};
+    elapsedMillis statTimer{0};
+    const uint32_t kStatInterval{2500};
+};
+
+
+#endif //JACKTRIP_TEENSY_CLOCKESTIMATOR_H
@@ -0,0 +1,202 @@
+#include "ClockSync.h"
+
+ClockSync::ClockSync() {
+    reset();
+}
+
+void ClockSync::reset() {
+    awaitingResponse = false;
+    started = false;
+    localElapsed = 0;
+    numMinima = 0;
+    nextMinimum = 0;
+    fitLocal = 0.;
+    fitOffset = 0.;
+    fitSlope = 0.;
+    accuracy = 0.f;
+    roundTrip = UINT32_MAX;
+    fitted = false;
+    numResponses = 0;
+}
+
+void ClockSync::makeRequest(ClockSyncPacket &request, uint32_t now) {
+    memcpy(request.Magic, CLOCK_SYNC_MAGIC, sizeof(request.Magic));
+    request.Id = nextId++;
+    request.ClientSend = now;
+    request.ServerReceive = 0;
+    request.ServerSend = 0;
+
+    requestId = request.Id;
+    requestTime = now;
+    awaitingResponse = true;
+}
+
+bool ClockSync::registerResponse(const ClockSyncPacket &response, uint32_t arrival) {
+    if (!awaitingResponse
+        || memcmp(response.Magic, CLOCK_SYNC_MAGIC, sizeof(response.Magic)) != 0
+        || response.Id != requestId
+        || response.ClientSend != requestTime) {
+        return false;
+    }
+    awaitingResponse = false;
+
+    auto elapsed{arrival - requestTime};
+    auto turnaround{static_cast<int64_t>(response.ServerSend - response.ServerReceive)};
+    if (turnaround < 0 || turnaround > elapsed) {
+        return false;
+    }
+
+    auto serverMid{static_cast<double>(static_cast<int64_t>(response.ServerReceive - serverOrigin))
+                   + .5 * static_cast<double>(turnaround)};
+    auto send{unwrap(requestTime)};
+
+    if (started && fabs(serverMid - send - .5 * elapsed - offsetAt(send + .5 * elapsed)) > MAX_OFFSET_JUMP) {
+        reset();
+    }
+
+    if (!started) {
+        serverOrigin = response.ServerReceive;
+        serverMid = .5 * static_cast<double>(turnaround);
+        localOrigin = requestTime;
+        lastLocal = requestTime;
+        localElapsed = 0;
+        send = 0.;
+        windowStart = 0.;
+        windowMin = Exchange{};
+        started = true;
+    }
+
+    localElapsed += arrival - lastLocal;
+    lastLocal = arrival;
+    ++numResponses;
+
+    Exchange e;
+    e.local = send + .5 * elapsed;
+    e.offset = serverMid - e.local;
+    e.roundTrip = elapsed - static_cast<uint32_t>(turnaround);
+
+    // Until there's a fit, just follow the shortest round trip.
+    if (!fitted && e.roundTrip <= roundTrip) {
+        fitLocal = e.local;
+        fitOffset = e.offset;
+        roundTrip = e.roundTrip;
+        accuracy = .5f * static_cast<float>(roundTrip);
+    }
+
+    if (e.roundTrip < windowMin.roundTrip) {
+        windowMin = e;
+    }
+
+    if (e.local - windowStart >= WINDOW_LENGTH) {
+        minima[nextMinimum] = windowMin;
+        nextMinimum = (nextMinimum + 1) % NUM_WINDOWS;
+        if (numMinima < NUM_WINDOWS) {
+            ++numMinima;
+        }
+        fit();
+
+        windowStart = e.local;
+        windowMin = e;
+    }
+
+    return true;
+}
+
+void ClockSync::fit() {
+    if (numMinima < 2) {
+        return;
+    }
+
+    // Work relative to the mean to keep the sums well-conditioned.
+    Exchange mean;
+    for (int i = 0; i < numMinima; ++i) {
+        mean.local += minima[i].local;
+        mean.offset += minima[i].offset;
+    }
+    mean.local /= numMinima;
+    mean.offset /= numMinima;
+
+    auto sxx{0.}, sxy{0.};
+    for (int i = 0; i < numMinima; ++i) {
+        auto dx{minima[i].local - mean.local};
+        sxx += dx * dx;
+        sxy += dx * (minima[i].offset - mean.offset);
+    }
+
+    if (sxx <= 0.) {
+        return;
+    }
+
+    auto slope{sxy / sxx};
+    if (fabs(slope) > MAX_SKEW) {
+        return;
+    }
+
+    fitLocal = mean.local;
+    fitOffset = mean.offset;
+    fitSlope = slope;
+    fitted = true;
+
+    auto sumSquares{0.};
+    roundTrip = UINT32_MAX;
+    for (int i = 0; i < numMinima; ++i) {
+        auto residual{minima[i].offset - offsetAt(minima[i].local)};
+        sumSquares += residual * residual;
+        roundTrip = min(roundTrip, minima[i].roundTrip);
+    }
+    // Two points fit exactly, so say nothing about accuracy.
+    accuracy = numMinima > 2
+               ? static_cast<float>(sqrt(sumSquares / (numMinima - 2)))
+               : .5f * static_cast<float>(roundTrip);
+}
+
+double ClockSync::unwrap(uint32_t localTime) const {
+    return static_cast<double>(localElapsed) + static_cast<int32_t>(localTime - lastLocal);
+}
+
+double ClockSync::offsetAt(double local) const {
+    return fitOffset + fitSlope * (local - fitLocal);
+}
+
+bool ClockSync::isValid() const {
+    return started;
+}
+
+uint64_t ClockSync::toServer(uint32_t localTime) const {
+    auto local{unwrap(localTime)};
+    return serverOrigin + static_cast<uint64_t>(static_cast<int64_t>(local + offsetAt(local)));
+}
+
+uint32_t ClockSync::toLocal(uint64_t serverTime) const {
+    auto server{static_cast<double>(static_cast<int64_t>(serverTime - serverOrigin))};
+    auto local{(server - fitOffset + fitSlope * fitLocal) / (1. + fitSlope)};
+    return localOrigin + static_cast<uint32_t>(static_cast<int64_t>(local));
+}
+
+double ClockSync::getSkew() const {
+    return 1. + fitSlope;
+}
+
+float ClockSync::getAccuracy() const {
+    return accuracy;
+}
+
+uint32_t ClockSync::getRoundTrip() const {
+    return roundTrip;
+}
+
+void ClockSync::printStats() {
+    if (started && statTimer > kStatInterval) {
+        auto now{micros()};
+        Serial.printf("ClockSync: %s, offset %" PRId64 " µs, skew %.1f ppm, accuracy %.1f µs, "
+                      "round trip %" PRIu32 " µs (%" PRIu32 " responses, %d windows)\n",
+                      fitted ? "fitted" : "not fitted",
+                      static_cast<int64_t>(toServer(now) - now),
+                      fitSlope * 1e6,
+                      accuracy,
+                      roundTrip,
+                      numResponses,
+                      numMinima);
+        statTimer = 0;
+    }
+}
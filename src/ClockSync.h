@@ -0,0 +1,154 @@
+#ifndef JACKTRIP_TEENSY_CLOCKSYNC_H
+#define JACKTRIP_TEENSY_CLOCKSYNC_H
+
+#include "Arduino.h"
+#include "PacketHeader.h"
+
+/**
+ * Estimates a server's clock in terms of the local clock, micros(), from
+ * two-way exchanges of ClockSyncPackets, as in NTP and PTP. Each exchange
+ * gives the offset between the clocks at its midpoint, assuming the request
+ * and response take equally long, and a round trip time. Queueing only ever
+ * lengthens the round trip, so each window of exchanges is represented by the
+ * one with the shortest; offset and skew are then a line fitted to those.
+ * Unlike ClockEstimator, which assumes a minimum one-way delay, this gives
+ * the server's time itself, so every client synchronised to the same server
+ * agrees on it, whatever its network path.
+ */
+class ClockSync {
+public:
+    ClockSync();
+
+    void reset();
+
+    /**
+     * Fill in a request, and note it as the one awaiting a response. Any
+     * earlier request is abandoned.
+     * @param now value of micros() as the request is sent.
+     */
+    void makeRequest(ClockSyncPacket &request, uint32_t now);
+
+    /**
+     * Register a response.
+     * @param arrival value of micros() when the response arrived.
+     * @return <em>true</em> if the response was to the latest request,
+     * <em>false</em> if it was ignored.
+     */
+    bool registerResponse(const ClockSyncPacket &response, uint32_t arrival);
+
+    bool isValid() const;
+
+    /**
+     * Get the server's time at a given local time.
+     * @param localTime a value of micros() within a few seconds of the
+     * latest response.
+     */
+    uint64_t toServer(uint32_t localTime) const;
+
+    /**
+     * The inverse of toServer(): get the local time, in terms of micros(), at
+     * a given server time.
+     */
+    uint32_t toLocal(uint64_t serverTime) const;
+
+    /**
+     * Get the number of server microseconds per local microsecond.
+     */
+    double getSkew() const;
+
+    /**
+     * Get the RMS deviation, in microseconds, of the exchanges fitted from
+     * the estimated offset; until there are enough of them, half the
+     * shortest round trip, which bounds the error of a single exchange.
+     * Asymmetry between the request and response paths isn't measurable, so
+     * isn't included.
+     */
+    float getAccuracy() const;
+
+    /**
+     * Get the shortest round trip time, in microseconds, in the current
+     * windows, less the responder's turnaround.
+     */
+    uint32_t getRoundTrip() const;
+
+    void printStats();
+
+private:
+    /**
+     * Length, in local microseconds, of the windows from which the exchange
+     * with the shortest round trip is taken. Responses wait up to an audio
+     * block to be seen, so each window needs enough exchanges for one to
+     * have arrived just before an update: at JackTripClient's default request
+     * interval of 10 ms, two seconds gives 200, enough for synchronised
+     * playout to agree to within a sample.
+     */
+    static constexpr uint32_t WINDOW_LENGTH{2'000'000};
+    /**
+     * Number of window minima to which to fit offset and skew.
+     */
+    static constexpr uint8_t NUM_WINDOWS{16};
+    /**
+     * Largest plausible skew between two crystal oscillators; anything beyond
+     * this is treated as a bad fit.
+     */
+    static constexpr double MAX_SKEW{.001};
+    /**
+     * Discrepancy, in microseconds, between an exchange's offset and that
+     * estimated beyond which to assume the server's clock has been reset, and
+     * start again.
+     */
+    static constexpr double MAX_OFFSET_JUMP{1'000'000.};
+
+    struct Exchange {
+        /**
+         * Local time at the exchange's midpoint, relative to localOrigin;
+         * server time less local time, relative to serverOrigin.
+         */
+        double local{0.}, offset{0.};
+        uint32_t roundTrip{UINT32_MAX};
+    };
+
+    /**
+     * Get a local time relative to localOrigin, unwrapped.
+     */
+    double unwrap(uint32_t localTime) const;
+
+    /**
+     * Get the estimated offset at a local time relative to localOrigin.
+     */
+    double offsetAt(double local) const;
+
+    /**
+     * Fit offset and skew to the window minima by least squares.
+     */
+    void fit();
+
+    uint32_t nextId{0};
+    bool awaitingResponse{false};
+    uint32_t requestId{0}, requestTime{0};
+
+    bool started{false};
+    uint64_t serverOrigin{0};
+    uint32_t localOrigin{0}, lastLocal{0};
+    /**
+     * Local time from localOrigin to lastLocal, unwrapped.
+     */
+    uint64_t localElapsed{0};
+    double windowStart{0.};
+    Exchange windowMin;
+    Exchange minima[NUM_WINDOWS];
+    uint8_t numMinima{0}, nextMinimum{0};
+    /**
+     * The fitted line: offset at local time fitLocal, and its slope.
+     */
+    double fitLocal{0.}, fitOffset{0.}, fitSlope{0.};
+    float accuracy{0.f};
+    uint32_t roundTrip{UINT32_MAX};
+    bool fitted{false};
+    uint32_t numResponses{0};
+    elapsedMillis statTimer{0};
+    const uint32_t kStatInterval{2500};
+};
+
+
+#endif //JACKTRIP_TEENSY_CLOCKSYNC_H
@@ -6,11 +6,20 @@
 
 JackTripClient::JackTripClient(uint8_t numChannels,
                                IPAddress &serverIpAddress,
-                               uint16_t serverTcpPort) :
-        AudioStream{numChannels, new audio_block_t *[numChannels]},
-        kNumChannels{numChannels},
-        kUdpPacketSize{PACKET_HEADER_SIZE + kNumChannels * AUDIO_BLOCK_SAMPLES * sizeof(uint16_t)},
-        kAudioPacketSize{AUDIO_BLOCK_SAMPLES * kNumChannels * 2u},
+                               uint16_t serverTcpPort,
+                               DriftMode driftMode) :
+        JackTripClient(numChannels, numChannels, serverIpAddress, serverTcpPort, driftMode) {}
+
+JackTripClient::JackTripClient(uint8_t numReceiveChannels,
+                               uint8_t numSendChannels,
+                               IPAddress &serverIpAddress,
+                               uint16_t serverTcpPort,
+                               DriftMode driftMode) :
+        AudioStream{numSendChannels, new audio_block_t *[numSendChannels]},
+        kNumReceiveChannels{numReceiveChannels},
+        kNumSendChannels{numSendChannels},
+        kMaxUdpPacketSize{PACKET_HEADER_SIZE + max(kNumReceiveChannels, kNumSendChannels) * MAX_BUFFER_SIZE * MAX_SAMPLE_SIZE},
+        kAudioPacketSize{AUDIO_BLOCK_SAMPLES * kNumReceiveChannels * 2u},
         // Assume client and server on same subnet
         clientIP{serverIpAddress},
         serverIP{serverIpAddress},
@@ -18,9 +27,16 @@ JackTripClient::JackTripClient(uint8_t numChannels,
 #ifdef USE_TIMER
         timer(TeensyTimerTool::GPT1),
 #endif
-        udpBuffer(kUdpPacketSize * 16),
-        audioBuffer(kNumChannels, AUDIO_BLOCK_SAMPLES * 8),
-        audioBlock(new int16_t *[kNumChannels]) {
+        udpPacketSize{PACKET_HEADER_SIZE + kNumSendChannels * CHANNEL_FRAME_SIZE},
+        channelsPerPacket{numSendChannels},
+        receivePacketBuffer(new uint8_t[kMaxUdpPacketSize]),
+        audioBuffer(kNumReceiveChannels, MAX_BUFFER_SIZE * BUFFER_PERIODS, driftMode),
+        audioBlock(new int16_t *[kNumReceiveChannels]),
+        receiveBlock(new int16_t *[kNumReceiveChannels]),
+        reassemblyReceived(new bool[kNumReceiveChannels]{}),
+        sendBuffer(kNumSendChannels, MAX_BUFFER_SIZE * BUFFER_PERIODS),
+        sendBlock(new int16_t *[kNumSendChannels]),
+        sendPacketBuffer(new uint8_t[kMaxUdpPacketSize + SUB_STREAM_HEADER_SIZE + MAX_DTX_MASK_SIZE]) {
 
     // Generate a MAC address (from the program-once area of Teensy's flash
     // memory) to assign to the ethernet shield.
@@ -29,19 +45,35 @@ JackTripClient::JackTripClient(uint8_t numChannels,
     // (Maybe needs a more sophisticated approach.)
     clientIP[3] += clientMAC[5];
 
-    serverHeader = new JackTripPacketHeader;
-
-    for (int ch = 0; ch < kNumChannels; ++ch) {
+    for (int ch = 0; ch < kNumReceiveChannels; ++ch) {
         audioBlock[ch] = new int16_t[AUDIO_BLOCK_SAMPLES];
+        receiveBlock[ch] = new int16_t[MAX_BUFFER_SIZE];
     }
+    for (int ch = 0; ch < kNumSendChannels; ++ch) {
+        sendBlock[ch] = new int16_t[MAX_BUFFER_SIZE];
+    }
+
+    audioBuffer.setLength(AUDIO_BLOCK_SAMPLES * BUFFER_PERIODS);
+    sendBuffer.setLength(AUDIO_BLOCK_SAMPLES * BUFFER_PERIODS);
+
+    sendBuffer.setPrimingLength(2);
+    sendBuffer.setFixedIncrement(1.f);
 }
 
 JackTripClient::~JackTripClient() {
-    delete serverHeader;
-    for (int ch = 0; ch < kNumChannels; ++ch) {
+    for (int ch = 0; ch < kNumReceiveChannels; ++ch) {
         delete[] audioBlock[ch];
+        delete[] receiveBlock[ch];
+    }
+    for (int ch = 0; ch < kNumSendChannels; ++ch) {
+        delete[] sendBlock[ch];
     }
     delete[] audioBlock;
+    delete[] receiveBlock;
+    delete[] reassemblyReceived;
+    delete[] sendBlock;
+    delete[] sendPacketBuffer;
+    delete[] receivePacketBuffer;
 }
 
 uint8_t JackTripClient::begin(uint16_t port) {
@@ -50,10 +82,11 @@ uint8_t JackTripClient::begin(uint16_t port) {
         return 0;
     }
 
-    if (kUdpPacketSize > FNET_SOCKET_DEFAULT_SIZE) {
-        Serial.printf("JackTripClient: UDP packet size (%d) is greater than the default socket size (%d). "
-                      "Increasing to match.\n", kUdpPacketSize, FNET_SOCKET_DEFAULT_SIZE);
-        EthernetClass::setSocketSize(kUdpPacketSize);
+    auto maxPacketSize{max(kMaxUdpPacketSize, multicastPacketSize)};
+    if (maxPacketSize > FNET_SOCKET_DEFAULT_SIZE) {
+        Serial.printf("JackTripClient: Maximum UDP packet size (%d) is greater than the default socket size (%d). "
+                      "Increasing to match.\n", maxPacketSize, FNET_SOCKET_DEFAULT_SIZE);
+        EthernetClass::setSocketSize(maxPacketSize);
     }
 
     Serial.print("JackTripClient: MAC address is: ");
@@ -74,7 +107,11 @@ uint8_t JackTripClient::begin(uint16_t port) {
     Serial.print("JackTripClient: IP is ");
     Serial.println(EthernetClass::localIP());
 
-    Serial.printf("JackTripClient: Packet size is %d bytes\n", kUdpPacketSize);
+    Serial.printf("JackTripClient: Packet size is %d bytes\n", udpPacketSize);
+    if (channelsPerPacket < kNumSendChannels) {
+        Serial.printf("JackTripClient: Splitting packets to fit MTU of %d bytes (up to %d channels per packet)\n",
+                      mtu, channelsPerPacket);
+    }
 
 #ifdef USE_TIMER
     auto timerPeriod = 1'000'000.f * static_cast<float>(AUDIO_BLOCK_SAMPLES) / AUDIO_SAMPLE_RATE_EXACT;
@@ -82,13 +119,53 @@ uint8_t JackTripClient::begin(uint16_t port) {
     timer.begin([this] { updateImpl(); }, timerPeriod);
 #endif
 
-    return EthernetUDP::begin(port);
+    return multicast ? EthernetUDP::beginMulticast(multicastGroup, port) : EthernetUDP::begin(port);
 }
 
 bool JackTripClient::connect(uint16_t timeout) {
+    if (connectionState != ConnectionState::AWAITING_PORT) {
+        startHandshake(timeout);
+    }
+    // awaitServerPort() gives up eventually, so this can't wait forever.
+    while (connectionState == ConnectionState::AWAITING_PORT) {
+        awaitServerPort();
+        yield();
+    }
+    return connected;
+}
+
+void JackTripClient::advanceConnection(uint16_t timeout) {
+    switch (connectionState) {
+        case ConnectionState::WAITING:
+            if (connectionTimer >= reconnectBackoff) {
+                startHandshake(timeout);
+            }
+            break;
+        case ConnectionState::AWAITING_PORT:
+            awaitServerPort();
+            break;
+        case ConnectionState::CONNECTED:
+            break;
+    }
+}
+
+void JackTripClient::startHandshake(uint16_t timeout) {
     if (!active) {
         Serial.println("JackTripClient is not connected to any Teensy audio objects.");
-        return false;
+        retryConnection();
+        return;
+    }
+
+    if (multicast) {
+        // The group was joined in begin(); there's no server to greet.
+        Serial.print("JackTripClient: Receiving multicast from ");
+        Serial.print(multicastGroup);
+        Serial.printf(", channels %d to %d\n", firstChannel + 1, firstChannel + kNumReceiveChannels);
+        lastReceive = 0;
+        connected = true;
+        connectionState = ConnectionState::CONNECTED;
+        reconnectBackoff = 0;
+        return;
     }
 
     // Attempt TCP handshake with JackTrip server.
@@ -96,37 +173,49 @@ bool JackTripClient::connect(uint16_t timeout) {
     Serial.print(serverIP);
     Serial.printf(":%d... ", serverTcpPort);
 
-    EthernetClient c = EthernetClient();
-    c.setConnectionTimeout(timeout);
-    if (c.connect(serverIP, serverTcpPort)) {
+    handshakeClient.setConnectionTimeout(timeout);
+    if (handshakeClient.connect(serverIP, serverTcpPort)) {
         Serial.println("Succeeded!");
     } else {
         Serial.println();
-        return false;
+        retryConnection();
+        return;
     }
 
     // Sending the local UDP port yields the remote UDP port in return.
-    auto port = localPort();
+    uint32_t port{localPort()};
     // Send the local port.
-    if (4 != c.write(reinterpret_cast<const uint8_t *>(&port), 4)) {
+    if (4 != handshakeClient.write(reinterpret_cast<const uint8_t *>(&port), 4)) {
         Serial.println("JackTripClient: failed to send UDP port to server.");
-        c.close();
-        return false;
+        retryConnection();
+        return;
+    }
+
+    connectionState = ConnectionState::AWAITING_PORT;
+    connectionTimer = 0;
+}
+
+void JackTripClient::awaitServerPort() {
+    if (handshakeClient.available() < 4) {
+        if (!handshakeClient.connected()) {
+            Serial.println("JackTripClient: server closed the connection without sending its UDP port.");
+            retryConnection();
+        } else if (connectionTimer > PORT_REPLY_TIMEOUT_MS) {
+            Serial.println("JackTripClient: timed out waiting for UDP port from server.");
+            retryConnection();
+        }
+        return;
     }
-    // Patience...
-    while (c.available() < 4) {}
+
     // Read the remote port.
-    if (4 != c.read(reinterpret_cast<uint8_t *>(&port), 4)) {
+    uint32_t port{0};
+    if (4 != handshakeClient.read(reinterpret_cast<uint8_t *>(&port), 4)) {
         Serial.println("JackTripClient: failed to read UDP port from server.");
-        c.close();
-        connected = false;
-        return false;
-    } else {
-        connected = true;
-//        if (onConnected != nullptr) {
-//            onConnected();
-//        }
+        retryConnection();
+        return;
     }
+    // That's all the server has to say over TCP.
+    handshakeClient.close();
 
     serverUdpPort = port;
     Serial.printf("JackTripClient: Server port is %d\n", serverUdpPort);
@@ -134,20 +223,61 @@ bool JackTripClient::connect(uint16_t timeout) {
     lastReceive = 0;
     packetHeader.SeqNumber = 0;
     packetHeader.TimeStamp = 0;
+    timestampOrigin = 0;
+    timestampElapsed = 0.;
+    timestampLocked = false;
     prevServerHeader.TimeStamp = 0;
     prevServerHeader.SeqNumber = 0;
-    return connected;
+    connected = true;
+//    if (onConnected != nullptr) {
+//        onConnected();
+//    }
+
+    connectionState = ConnectionState::CONNECTED;
+    reconnectBackoff = 0;
+}
+
+void JackTripClient::retryConnection() {
+    handshakeClient.close();
+    connected = false;
+    reconnectBackoff = reconnectBackoff == 0
+                       ? MIN_RECONNECT_BACKOFF_MS
+                       : min(2 * reconnectBackoff, MAX_RECONNECT_BACKOFF_MS);
+    Serial.printf("JackTripClient: failed to connect; poll() will retry in %" PRIu32 " ms.\n", reconnectBackoff);
+    connectionState = ConnectionState::WAITING;
+    connectionTimer = 0;
 }
 
 void JackTripClient::stop() {
+    // Abandon any handshake in progress. Whether stopped by the user, the
+    // server's exit packet or a receive timeout, give the server a moment
+    // before poll() reconnects.
+    if (connectionState == ConnectionState::AWAITING_PORT) {
+        handshakeClient.close();
+    }
+    connectionState = ConnectionState::WAITING;
+    connectionTimer = 0;
+    reconnectBackoff = MIN_RECONNECT_BACKOFF_MS;
     connected = false;
     serverUdpPort = 0;
-    udpBuffer.clear();
-    audioBuffer.clear();
+    // The audio interrupt may be reading from the receive buffer.
+    audioBuffer.requestReset();
+    sendBuffer.clear();
+    sendBlockFill = 0;
+    sendDriftLocked = false;
+    lastReceivedSeq = -1;
+    reassemblySeq = -1;
+    reassemblyOpen = false;
+    pendingFormatCount = 0;
+    serverClock.reset();
+    timestampLocked = false;
+    clockSync.reset();
     packetStats.reset();
 }
 
 void JackTripClient::update(void) {
+    adaptInterpolation();
+
 #ifdef USE_TIMER
     doAudioOutputFromAudio();
 #else
@@ -170,15 +300,61 @@ void JackTripClient::updateImpl() {
 #ifndef USE_TIMER
     doAudioOutputFromAudio();
 #endif
-    sendPacket();
+    sendAudio();
 
     if (showStats && connected) {
         packetStats.printStats();
-//        udpBuffer.printStats();
         audioBuffer.printStats();
+        if (playoutDelay > 0 || disciplineTimestamps) {
+            serverClock.printStats();
+        }
+        if (clockSyncPort != 0) {
+            clockSync.printStats();
+        }
+    }
+}
+
+void JackTripClient::poll() {
+    advanceConnection(CONNECT_TIMEOUT_MS);
+
+    // Build any filters requested for resampling.
+    SincTable::prepare();
+
+    if (connected && clockSyncPort != 0 && clockSyncTimer >= clockSyncInterval) {
+        clockSyncTimer = 0;
+        sendClockSyncRequest();
+    }
+}
+
+void JackTripClient::sendClockSyncRequest() {
+    // The context that sends and receives audio uses the same socket.
+    noNetworkInterrupts();
+    ClockSyncPacket request;
+    clockSync.makeRequest(request, micros());
+    beginPacket(serverIP, clockSyncPort);
+    write(reinterpret_cast<const uint8_t *>(&request), CLOCK_SYNC_PACKET_SIZE);
+    auto result = endPacket();
+    networkInterrupts();
+
+    if (0 == result) {
+        Serial.println("JackTripClient: failed to send a clock sync request.");
     }
 }
 
+void JackTripClient::noNetworkInterrupts() {
+    AudioNoInterrupts();
+#ifdef USE_TIMER
+    NVIC_DISABLE_IRQ(IRQ_GPT1);
+#endif
+}
+
+void JackTripClient::networkInterrupts() {
+#ifdef USE_TIMER
+    NVIC_ENABLE_IRQ(IRQ_GPT1);
+#endif
+    AudioInterrupts();
+}
+
 bool JackTripClient::isConnected() const {
     return connected;
 }
@@ -187,57 +363,149 @@ int JackTripClient::receivePackets() {
     if (!connected) return -1;
 
     auto received{0}, size{0};
+    burstLength = 0;
 
     // Check for incoming UDP packets. Get as many packets as are available.
     RECEIVE_CONDITION ((size = parsePacket()) > 0) {
+        auto arrival{micros()};
         ++received;
-        lastReceive = 0;
 
-        if (size == EXIT_PACKET_SIZE && isExitPacket()) {
-            // Exit sequence
-            Serial.println("JackTripClient: Received exit packet");
-            Serial.printf("  maxmem: %d blocks\n", AudioMemoryUsageMax());
-            Serial.printf("  maxcpu: %f %%\n\n", AudioProcessorUsageMax());
+        if (clockSyncPort != 0
+            && size == static_cast<int>(CLOCK_SYNC_PACKET_SIZE)
+            && remoteIP() == serverIP
+            && remotePort() == clockSyncPort) {
+            ClockSyncPacket response;
+            read(reinterpret_cast<uint8_t *>(&response), CLOCK_SYNC_PACKET_SIZE);
+            clockSync.registerResponse(response, arrival);
+            continue;
+        }
+
+        // Ignore anything but the server's packets, leaving them unread for
+        // parsePacket() to discard.
+        if (!multicast && (remoteIP() != serverIP || remotePort() != serverUdpPort)) {
+            setReceiveStatus(ReceiveStatus::FOREIGN_SOURCE);
+            continue;
+        }
+        lastReceive = 0;
 
-            stop();
-            return received;
-        } else if (size != kUdpPacketSize) {
-            Serial.println("JackTripClient: Received a malformed packet");
+        if (size < static_cast<int>(PACKET_HEADER_SIZE)) {
+            setReceiveStatus(ReceiveStatus::BAD_PACKET_SIZE);
         } else {
-            // Read the UDP packet and write it into a circular buffer.
-            uint8_t in[size];
-            auto bytesRead = read(in, size);
-//            Serial.printf("Read %d bytes\n", bytesRead);
-//            udpBuffer.write(in, size);
-
-            // Convert to audio and write that to a circular buffer.
-            const int16_t *audio[kNumChannels];
-            for (int ch = 0; ch < kNumChannels; ++ch) {
-                audio[ch] = reinterpret_cast<int16_t *>(in + PACKET_HEADER_SIZE + CHANNEL_FRAME_SIZE * ch);
-            }
-            audioBuffer.write(audio, AUDIO_BLOCK_SAMPLES);
+            auto in{receivePacketBuffer};
 
             // Read the header from the packet received from the server.
-            serverHeader = reinterpret_cast<JackTripPacketHeader *>(in);
-
-            if (packetStats.awaitingFirstReceive()) { //|| timestampInterval > 1000) {
-//                timestampInterval = 0;
-
-                if (packetStats.awaitingFirstReceive() && showStats) {
-                    Serial.println("===============================================================");
-                    Serial.printf("Received first packet: Timestamp: %" PRIu64 "; SeqNumber: %" PRIu16 "\n",
-                                  serverHeader->TimeStamp,
-                                  serverHeader->SeqNumber);
-                    packetHeader.TimeStamp = serverHeader->TimeStamp;
-                    packetHeader.SeqNumber = serverHeader->SeqNumber;
-                    Serial.println("===============================================================");
+            read(in, PACKET_HEADER_SIZE);
+
+            if (size == EXIT_PACKET_SIZE && isExitPacket(in)) {
+                // Exit sequence
+                Serial.println("JackTripClient: Received exit packet");
+                Serial.printf("  maxmem: %d blocks\n", AudioMemoryUsageMax());
+                Serial.printf("  maxcpu: %f %%\n\n", AudioProcessorUsageMax());
+
+                stop();
+                return received;
+            }
+
+            memcpy(&serverHeader, in, PACKET_HEADER_SIZE);
+
+            // A packet holding part of a block has a further header.
+            JackTripSubStreamHeader subStream{0, 0};
+            if (serverHeader.BitResolution & BIT_RESOLUTION_SUB_STREAM) {
+                read(reinterpret_cast<uint8_t *>(&subStream), SUB_STREAM_HEADER_SIZE);
+                serverHeader.BitResolution &= ~BIT_RESOLUTION_SUB_STREAM;
+                size -= SUB_STREAM_HEADER_SIZE;
+            }
+
+            // As may a packet from which silent channels have been left out.
+            uint8_t dtxMask[MAX_DTX_MASK_SIZE];
+            const uint8_t *presenceMask{nullptr};
+            if (serverHeader.BitResolution & BIT_RESOLUTION_DTX) {
+                auto maskSize{dtxMaskSize(serverHeader.NumIncomingChannelsFromNet)};
+                read(dtxMask, maskSize);
+                serverHeader.BitResolution &= ~BIT_RESOLUTION_DTX;
+                size -= maskSize;
+                presenceMask = dtxMask;
+            }
+
+            // Drop duplicate and out-of-date packets before reading their
+            // audio.
+            if (!isNewSequence(serverHeader.SeqNumber, subStream.TotalChannels > 0)) {
+                setReceiveStatus(ReceiveStatus::STALE);
+                continue;
+            }
+
+            uint8_t numChannels{0};
+            auto status{validatePacket(size, subStream, presenceMask, numChannels)};
+            setReceiveStatus(status);
+            if (status != ReceiveStatus::OK && status != ReceiveStatus::CHANNEL_MISMATCH) {
+                continue;
+            }
+            lastReceivedSeq = serverHeader.SeqNumber;
+
+            // Read only this client's channels; parsePacket() discards the
+            // rest.
+            auto channelSize{channelBytes(receiveResolution, serverBufferSize)};
+            auto from{max(static_cast<int>(firstChannel), static_cast<int>(subStream.FirstChannel))};
+            auto to{min(firstChannel + kNumReceiveChannels, subStream.FirstChannel + numChannels)};
+            to = max(from, to);
+            auto numSkipped{0}, numWanted{0};
+            for (int c = subStream.FirstChannel; c < to; ++c) {
+                if (isChannelPresent(presenceMask, c - subStream.FirstChannel)) {
+                    c < from ? ++numSkipped : ++numWanted;
+                }
+            }
+            auto payload{in + PACKET_HEADER_SIZE};
+            discard(numSkipped * channelSize, payload, kMaxUdpPacketSize - PACKET_HEADER_SIZE);
+            read(payload, numWanted * channelSize);
+
+            // Locate each of this client's channels in the payload; those the
+            // packet doesn't carry, or that are silent, have no data.
+            const uint8_t *channelData[kNumReceiveChannels];
+            auto data{payload};
+            for (int ch = 0; ch < kNumReceiveChannels; ++ch) {
+                auto c{firstChannel + ch};
+                channelData[ch] = nullptr;
+                if (c >= from && c < to && isChannelPresent(presenceMask, c - subStream.FirstChannel)) {
+                    channelData[ch] = data;
+                    data += channelSize;
                 }
             }
 
-            packetStats.registerReceive(*serverHeader);
+            if (numChannels < subStream.TotalChannels) {
+                receiveSubStream(channelData, from - firstChannel, to - from, subStream.TotalChannels, arrival);
+                continue;
+            }
+
+            // Convert to audio and write that to a circular buffer. 16-bit
+            // audio can be used in place. Channels the server doesn't send
+            // are silent.
+            const int16_t *audio[kNumReceiveChannels];
+            for (int ch = 0; ch < kNumReceiveChannels; ++ch) {
+                if (!channelData[ch]) {
+                    audio[ch] = receiveBlock[ch];
+                    memset(receiveBlock[ch], 0, serverBufferSize * sizeof(int16_t));
+                } else if (receiveResolution == BIT16 * 8) {
+                    audio[ch] = reinterpret_cast<const int16_t *>(channelData[ch]);
+                } else {
+                    unpackSamples(channelData[ch], receiveBlock[ch], serverBufferSize, receiveResolution);
+                    audio[ch] = receiveBlock[ch];
+                }
+            }
+            writeReceivedBlock(audio, serverHeader, arrival);
         }
     }
 
+    // After a stall, skip the backlog rather than play it out, if it has
+    // raised latency by more than the burst allowed.
+    auto expected{max(1, AUDIO_BLOCK_SAMPLES / serverBufferSize)};
+    if (catchUpBurst > 0 && burstLength > expected + catchUpBurst) {
+        audioBuffer.requestCatchUp(catchUpCrossfade, static_cast<float>(catchUpBurst * serverBufferSize));
+    }
+    auto caughtUp{audioBuffer.takeCatchUpSkipped()};
+    if (caughtUp > 0) {
+        packetStats.registerCatchUp(caughtUp);
+    }
+
     if (lastReceive > RECEIVE_TIMEOUT_MS) {
         Serial.printf("JackTripClient: Nothing received for %.1f s. Stopping.\n", RECEIVE_TIMEOUT_MS / 1000.f);
         stop();
@@ -246,89 +514,552 @@ int JackTripClient::receivePackets() {
     return received;
 }
 
-void JackTripClient::sendPacket() {
+void JackTripClient::sendAudio() {
     // Might have received an exit packet, so check whether still connected.
     if (!connected) return;
 
-    // Get the location in the UDP buffer to which audio samples should be
-    // written.
-    uint8_t packet[kUdpPacketSize];
-    uint8_t *pos = packet + PACKET_HEADER_SIZE;
+    static const int16_t silence[AUDIO_BLOCK_SAMPLES]{};
 
-    // Copy audio to the UDP buffer.
     audio_block_t *inBlock[num_inputs];
+    const int16_t *audio[kNumSendChannels];
     for (int channel = 0; channel < num_inputs; channel++) {
         inBlock[channel] = receiveReadOnly(channel);
-        // Only proceed if a block was returned, i.e. something is connected
-        // to one of this object's input channels.
+        // Send silence for any input channel that isn't connected to
+        // anything.
+        audio[channel] = inBlock[channel] ? inBlock[channel]->data : silence;
+    }
+
+    if (multicast) {
+        // Nothing to send to.
+    } else if (resampling || compensateSendDrift) {
+        if (compensateSendDrift) {
+            updateSendIncrement();
+        }
+        // Send as many server-rate packets as have accumulated.
+        sendBuffer.write(audio, AUDIO_BLOCK_SAMPLES);
+        while (sendBuffer.getNumReadable() >= packetHeader.BufferSize) {
+            sendBuffer.read(sendBlock, packetHeader.BufferSize);
+            sendPacket(const_cast<const int16_t **>(sendBlock));
+        }
+    } else if (packetHeader.BufferSize == AUDIO_BLOCK_SAMPLES) {
+        sendPacket(audio);
+    } else {
+        // Re-block, sending whenever a packet's worth has accumulated.
+        for (uint16_t n = 0; n < AUDIO_BLOCK_SAMPLES;) {
+            auto numToCopy{min(static_cast<uint16_t>(AUDIO_BLOCK_SAMPLES - n),
+                               static_cast<uint16_t>(packetHeader.BufferSize - sendBlockFill))};
+            for (int ch = 0; ch < kNumSendChannels; ++ch) {
+                memcpy(sendBlock[ch] + sendBlockFill, audio[ch] + n, numToCopy * sizeof(int16_t));
+            }
+            n += numToCopy;
+            sendBlockFill += numToCopy;
+            if (sendBlockFill == packetHeader.BufferSize) {
+                sendPacket(const_cast<const int16_t **>(sendBlock));
+                sendBlockFill = 0;
+            }
+        }
+    }
+
+    for (int channel = 0; channel < num_inputs; channel++) {
         if (inBlock[channel]) {
-            memcpy(pos, inBlock[channel]->data, CHANNEL_FRAME_SIZE);
-            pos += CHANNEL_FRAME_SIZE;
             release(inBlock[channel]);
         }
     }
+}
 
+void JackTripClient::sendPacket(const int16_t **audio) {
     packetHeader.SeqNumber++;
-    packetHeader.TimeStamp += packetInterval;
-    packetInterval = 0;
+    advanceTimestamp();
+    samplesSent += packetHeader.BufferSize;
+
+    // Send the channels in as many packets as it takes to fit the MTU; just
+    // one, unless splitting.
+    auto packet{sendPacketBuffer};
+    auto split{channelsPerPacket < kNumSendChannels};
+    for (int first = 0; first < kNumSendChannels; first += channelsPerPacket) {
+        auto numChannels{min(static_cast<int>(channelsPerPacket), kNumSendChannels - first)};
+        auto header{packetHeader};
+        header.NumIncomingChannelsFromNet = numChannels;
+        uint8_t *pos = packet + PACKET_HEADER_SIZE;
+
+        if (split) {
+            header.BitResolution |= BIT_RESOLUTION_SUB_STREAM;
+            JackTripSubStreamHeader subStream{static_cast<uint8_t>(first), kNumSendChannels};
+            memcpy(pos, &subStream, SUB_STREAM_HEADER_SIZE);
+            pos += SUB_STREAM_HEADER_SIZE;
+        }
+
+        // Leave out silent channels, if there are any.
+        bool silent[numChannels];
+        uint8_t *mask{nullptr};
+        if (dtx) {
+            auto numSilent{0};
+            for (int ch = 0; ch < numChannels; ++ch) {
+                silent[ch] = isSilent(audio[first + ch], packetHeader.BufferSize, dtxThreshold);
+                numSilent += silent[ch];
+            }
+            if (numSilent > 0) {
+                header.BitResolution |= BIT_RESOLUTION_DTX;
+                mask = pos;
+                memset(mask, 0, dtxMaskSize(numChannels));
+                pos += dtxMaskSize(numChannels);
+            }
+        }
+
+        // Copy audio to the UDP buffer, in the current wire format.
+        for (int ch = 0; ch < numChannels; ++ch) {
+            if (mask) {
+                if (silent[ch]) {
+                    continue;
+                }
+                mask[ch / 8] |= 1 << (ch % 8);
+            }
+            packSamples(audio[first + ch], pos, packetHeader.BufferSize, packetHeader.BitResolution);
+            pos += channelBytes(packetHeader.BitResolution, packetHeader.BufferSize);
+        }
+
+        // Copy the packet header to the UDP buffer, and send the packet.
+        memcpy(packet, &header, PACKET_HEADER_SIZE);
+        sendDatagram(packet, pos - packet);
+    }
 
-    // Copy the packet header to the UDP buffer.
-    memcpy(packet, &packetHeader, PACKET_HEADER_SIZE);
+    packetStats.registerSend(packetHeader);
+}
 
-    // Send the packet.
+void JackTripClient::sendDatagram(const uint8_t *data, size_t size) {
     beginPacket(serverIP, serverUdpPort);
-    size_t written = write(packet, kUdpPacketSize);
-    if (written != kUdpPacketSize) {
-        written += write(packet + written, kUdpPacketSize - written);
-        if (written != kUdpPacketSize) {
-            Serial.printf("JackTripClient: Net buffer is too small (wrote %d of %d bytes)\n", written, kUdpPacketSize);
+    size_t written = write(data, size);
+    if (written != size) {
+        written += write(data + written, size - written);
+        if (written != size) {
+            Serial.printf("JackTripClient: Net buffer is too small (wrote %d of %d bytes)\n", written, size);
         }
     }
     auto result = endPacket();
     if (0 == result) {
         Serial.println("JackTripClient: failed to send a packet.");
     }
+}
 
-    packetStats.registerSend(packetHeader);
+void JackTripClient::advanceTimestamp() {
+    // Packets carry server-rate samples when resampling or following the
+    // server's clock, and Teensy-rate samples otherwise.
+    auto sampleRate{static_cast<double>(AUDIO_SAMPLE_RATE_EXACT)};
+    if (resampling || compensateSendDrift) {
+        auto serverRate{samplingRateToHz(packetHeader.SamplingRate)};
+        if (serverRate > 0.f) {
+            sampleRate = serverRate;
+        }
+    }
+    auto increment{1e6 * packetHeader.BufferSize / sampleRate};
+
+    if (disciplineTimestamps && serverClock.isValid()) {
+        // Teensy's sample clock and micros() share a crystal, so take the
+        // skew between micros() and the server's clock to be the sample
+        // clock's too; unless already following the server's clock.
+        if (!compensateSendDrift) {
+            increment /= serverClock.getSkew();
+        }
+        timestampElapsed += increment;
+
+        auto serverNow{serverClock.toRemote(micros())};
+        auto error{static_cast<double>(static_cast<int64_t>(serverNow - timestampOrigin)) - timestampElapsed};
+        if (!timestampLocked || fabs(error) > TIMESTAMP_STEP_THRESHOLD) {
+            timestampOrigin = serverNow;
+            timestampElapsed = 0.;
+            timestampLocked = true;
+        } else {
+            timestampElapsed += TIMESTAMP_DISCIPLINE_GAIN * error;
+        }
+    } else {
+        timestampElapsed += increment;
+    }
+
+    packetHeader.TimeStamp = timestampOrigin + static_cast<int64_t>(timestampElapsed);
 }
 
-void JackTripClient::doAudioOutputFromUDP() {
-    if (!connected) return;
+void JackTripClient::updateSendIncrement() {
+    if (!audioBuffer.isPrimed()) {
+        sendDriftLocked = false;
+        return;
+    }
 
-    // Copy from UDP inBuffer to audio output.
-    // Write samples to output.
-    audio_block_t *outBlock[kNumChannels];
-    uint8_t data[kUdpPacketSize];
-    // Read a packet from the input UDP buffer
-    udpBuffer.read(data, kUdpPacketSize);
-    for (int channel = 0; channel < kNumChannels; channel++) {
-        outBlock[channel] = allocate();
-        // Only proceed if an audio block was allocated, i.e. the
-        // current output channel is connected to something.
-        if (outBlock[channel]) {
-            // Get the start of the sample data in the packet. Cast to desired
-            // bit-resolution.
-            auto start = (const int16_t *) (data + PACKET_HEADER_SIZE + CHANNEL_FRAME_SIZE * channel);
-            // Copy the samples to the output block.
-            memcpy(outBlock[channel]->data, start, CHANNEL_FRAME_SIZE);
-#ifdef JACKTRIPCLIENT_DEBUG
-            auto header = reinterpret_cast<JackTripPacketHeader *>(data);
-            // Indicate the first sample in each packet.
-            outBlock[channel]->data[0] = INT16_MIN;
-            // Indicate this packet's timestamp.
-            outBlock[channel]->data[15] = static_cast<int16_t>(header->TimeStamp);
-#endif
-            // Finish up.
-            transmit(outBlock[channel], channel);
-            release(outBlock[channel]);
+    // Server samples sent, less server samples received (and consumed), since
+    // the receive buffer was primed.
+    auto consumed{audioBuffer.getSamplesConsumed()};
+    if (!sendDriftLocked) {
+        sendDriftOffset = samplesSent - consumed;
+        sendDriftLocked = true;
+    }
+    auto excess{static_cast<float>(samplesSent - consumed - sendDriftOffset)};
+
+    // Follow the server's clock, as measured by the rate at which received
+    // audio is consumed, and correct any accumulated excess or deficit.
+    sendBuffer.setFixedIncrement((1.f + SEND_DRIFT_CORRECTION * excess) / audioBuffer.getMeanIncrement());
+}
+
+void JackTripClient::schedulePlayout(const JackTripPacketHeader &header) {
+    auto serverRate{samplingRateToHz(header.SamplingRate)};
+    if (serverRate == 0.f) {
+        return;
+    }
+
+    if (synchronisedPlayout) {
+        if (!clockSync.isValid()) {
+            return;
+        }
+
+        auto playoutTime{clockSync.toLocal(header.TimeStamp + playoutDelay)};
+        auto lead{static_cast<int32_t>(playoutTime - micros())};
+        if (lead < -MAX_SYNCHRONISED_LEAD || lead > MAX_SYNCHRONISED_LEAD) {
+            if (synchronisedPlayoutWarningTimer >= RECEIVE_STATUS_INTERVAL_MS) {
+                Serial.printf("JackTripClient: Server timestamps are %" PRId32 " ms from clock sync time; "
+                              "not scheduling playout\n", lead / 1000);
+                synchronisedPlayoutWarningTimer = 0;
+            }
+            return;
+        }
+
+        audioBuffer.setPlayoutTime(playoutTime, serverRate * static_cast<float>(clockSync.getSkew()) / 1e6f);
+        return;
+    }
+
+    audioBuffer.setPlayoutTime(serverClock.toLocal(header.TimeStamp) + playoutDelay,
+                               serverRate / (1e6f * serverClock.getSkew()));
+}
+
+JackTripClient::ReceiveStatus JackTripClient::validatePacket(int size,
+                                                             JackTripSubStreamHeader &subStream,
+                                                             const uint8_t *presenceMask,
+                                                             uint8_t &numChannels) {
+    if (serverHeader.BufferSize == 0 || serverHeader.BufferSize > MAX_BUFFER_SIZE) {
+        return ReceiveStatus::UNSUPPORTED_BUFFER_SIZE;
+    }
+
+    if (samplingRateToHz(serverHeader.SamplingRate) == 0.f) {
+        return ReceiveStatus::UNSUPPORTED_SAMPLING_RATE;
+    }
+
+    if (!isAllowedResolution(serverHeader.BitResolution)) {
+        return ReceiveStatus::UNSUPPORTED_BIT_RESOLUTION;
+    }
+
+    // The number of channels in the packet; older servers leave this at
+    // zero, in which case infer it from the packet size.
+    auto channelSize{channelBytes(serverHeader.BitResolution, serverHeader.BufferSize)};
+    auto payloadSize{size - static_cast<int>(PACKET_HEADER_SIZE)};
+    numChannels = serverHeader.NumIncomingChannelsFromNet;
+    if (numChannels == 0 && presenceMask == nullptr) {
+        numChannels = payloadSize / channelSize;
+    }
+
+    // Channels left out as silent take no space.
+    auto numPresent{0};
+    for (int c = 0; c < numChannels; ++c) {
+        numPresent += isChannelPresent(presenceMask, c);
+    }
+
+    if (payloadSize != numPresent * channelSize) {
+        return ReceiveStatus::SIZE_MISMATCH;
+    }
+
+    if (subStream.TotalChannels == 0) {
+        subStream.TotalChannels = numChannels;
+    } else if (subStream.FirstChannel + numChannels > subStream.TotalChannels) {
+        return ReceiveStatus::BAD_SUB_STREAM;
+    }
+
+    // Only a packet that's consistent with its own header may change the
+    // client's configuration, and only once the next agrees with it.
+    if (serverHeader.BufferSize != serverBufferSize
+        || serverHeader.SamplingRate != packetHeader.SamplingRate
+        || serverHeader.BitResolution != receiveResolution) {
+        if (pendingFormatCount == 0
+            || serverHeader.BufferSize != pendingFormat.BufferSize
+            || serverHeader.SamplingRate != pendingFormat.SamplingRate
+            || serverHeader.BitResolution != pendingFormat.BitResolution) {
+            pendingFormat = serverHeader;
+            pendingFormatCount = 0;
+        }
+        if (++pendingFormatCount < FORMAT_CHANGE_PACKETS) {
+            return ReceiveStatus::FORMAT_CHANGE;
+        }
+
+        if (serverHeader.BufferSize != serverBufferSize) {
+            configureServerBufferSize(serverHeader.BufferSize);
+        }
+        if (serverHeader.SamplingRate != packetHeader.SamplingRate) {
+            configureSamplingRate(serverHeader.SamplingRate);
+        }
+        if (serverHeader.BitResolution != receiveResolution) {
+            configureBitResolution(serverHeader.BitResolution);
+        }
+    }
+    pendingFormatCount = 0;
+
+    // A multicast stream may carry channels for other clients too.
+    auto lastChannel{firstChannel + kNumReceiveChannels};
+    auto totalChannels{subStream.TotalChannels};
+    return totalChannels == lastChannel || (multicast && totalChannels > lastChannel)
+           ? ReceiveStatus::OK
+           : ReceiveStatus::CHANNEL_MISMATCH;
+}
+
+void JackTripClient::receiveSubStream(const uint8_t **channelData, int first, int numChannels,
+                                      uint8_t totalChannels, uint32_t arrival) {
+    auto seq{serverHeader.SeqNumber};
+    if (seq != reassemblySeq) {
+        // A new block; play whatever arrived of the last one.
+        if (reassemblyOpen) {
+            flushReassembly();
+        }
+        reassemblySeq = seq;
+        reassemblyOpen = true;
+        reassemblyHeader = serverHeader;
+        reassemblyArrival = arrival;
+        memset(reassemblyReceived, 0, kNumReceiveChannels * sizeof(bool));
+        reassemblyPending = max(0, min(static_cast<int>(totalChannels), firstChannel + kNumReceiveChannels) -
+                                   firstChannel);
+    } else if (!reassemblyOpen) {
+        // Part of a block that has already been played.
+        return;
+    }
+
+    for (int ch = first; ch < first + numChannels; ++ch) {
+        if (channelData[ch]) {
+            unpackSamples(channelData[ch], receiveBlock[ch], serverBufferSize, receiveResolution);
+        } else {
+            memset(receiveBlock[ch], 0, serverBufferSize * sizeof(int16_t));
+        }
+        if (!reassemblyReceived[ch]) {
+            reassemblyReceived[ch] = true;
+            --reassemblyPending;
+        }
+    }
+
+    if (reassemblyPending == 0) {
+        flushReassembly();
+    }
+}
+
+void JackTripClient::flushReassembly() {
+    reassemblyOpen = false;
+
+    const int16_t *audio[kNumReceiveChannels];
+    for (int ch = 0; ch < kNumReceiveChannels; ++ch) {
+        if (!reassemblyReceived[ch]) {
+            memset(receiveBlock[ch], 0, serverBufferSize * sizeof(int16_t));
+        }
+        audio[ch] = receiveBlock[ch];
+    }
+    writeReceivedBlock(audio, reassemblyHeader, reassemblyArrival);
+}
+
+void JackTripClient::writeReceivedBlock(const int16_t **audio, JackTripPacketHeader &header, uint32_t arrival) {
+    audioBuffer.write(audio, serverBufferSize, header.TimeStamp);
+    ++burstLength;
+
+    if (playoutDelay > 0 || disciplineTimestamps) {
+        serverClock.update(header.TimeStamp, arrival);
+    }
+    if (playoutDelay > 0) {
+        schedulePlayout(header);
+    }
+
+    if (packetStats.awaitingFirstReceive()) { //|| timestampInterval > 1000) {
+//        timestampInterval = 0;
+
+        timestampOrigin = header.TimeStamp;
+        timestampElapsed = 0.;
+        packetHeader.SeqNumber = header.SeqNumber;
+
+        if (showStats) {
+            Serial.println("===============================================================");
+            Serial.printf("Received first packet: Timestamp: %" PRIu64 "; SeqNumber: %" PRIu16 "\n",
+                          header.TimeStamp,
+                          header.SeqNumber);
+            Serial.println("===============================================================");
+        }
+    }
+
+    packetStats.registerReceive(header);
+}
+
+void JackTripClient::discard(int numBytes, uint8_t *scratch, int scratchSize) {
+    while (numBytes > 0) {
+        auto n{read(scratch, min(numBytes, scratchSize))};
+        if (n <= 0) {
+            return;
+        }
+        numBytes -= n;
+    }
+}
+
+void JackTripClient::setReceiveStatus(ReceiveStatus status) {
+    receiveStatus = status;
+
+    auto dropped{status != ReceiveStatus::OK && status != ReceiveStatus::CHANNEL_MISMATCH};
+    if (dropped) {
+        ++droppedPackets;
+    } else if (status == reportedStatus) {
+        return;
+    }
+
+    if (receiveStatusTimer < RECEIVE_STATUS_INTERVAL_MS) {
+        return;
+    }
+
+    if (dropped) {
+        Serial.printf("JackTripClient: Dropped %" PRIu32 " packets; latest: %s\n", droppedPackets, describe(status));
+    } else {
+        // Account for packets dropped since the last report.
+        if (droppedPackets > 0) {
+            Serial.printf("JackTripClient: Dropped %" PRIu32 " packets\n", droppedPackets);
+        }
+        if (status == ReceiveStatus::CHANNEL_MISMATCH) {
+            Serial.printf("JackTripClient: Server sends %d channels; expected %d\n",
+                          serverHeader.NumIncomingChannelsFromNet, firstChannel + kNumReceiveChannels);
+        } else {
+            Serial.println("JackTripClient: Receiving normally");
+        }
+    }
+
+    reportedStatus = status;
+    droppedPackets = 0;
+    receiveStatusTimer = 0;
+}
+
+const char *JackTripClient::describe(ReceiveStatus status) {
+    switch (status) {
+        case ReceiveStatus::OK:
+            return "OK";
+        case ReceiveStatus::CHANNEL_MISMATCH:
+            return "channel count mismatch";
+        case ReceiveStatus::BAD_PACKET_SIZE:
+            return "bad packet size";
+        case ReceiveStatus::SIZE_MISMATCH:
+            return "packet size doesn't match header";
+        case ReceiveStatus::UNSUPPORTED_BUFFER_SIZE:
+            return "unsupported buffer size";
+        case ReceiveStatus::UNSUPPORTED_SAMPLING_RATE:
+            return "unsupported sampling rate";
+        case ReceiveStatus::UNSUPPORTED_BIT_RESOLUTION:
+            return "unsupported bit resolution";
+        case ReceiveStatus::BAD_SUB_STREAM:
+            return "bad sub-stream header";
+        case ReceiveStatus::FOREIGN_SOURCE:
+            return "packet from unexpected source";
+        case ReceiveStatus::STALE:
+            return "duplicate or late packet";
+        case ReceiveStatus::FORMAT_CHANGE:
+            return "unconfirmed change of format";
+        default:
+            return "unknown";
+    }
+}
+
+bool JackTripClient::isAllowedResolution(uint8_t bitResolution) {
+    return isSupportedResolution(bitResolution) && bytesPerSample(bitResolution) <= MAX_SAMPLE_SIZE;
+}
+
+void JackTripClient::configureBitResolution(uint8_t bitResolution) {
+    if (!isAllowedResolution(bitResolution)) {
+        return;
+    }
+
+    receiveResolution = bitResolution;
+    if (!sendAdpcm) {
+        packetHeader.BitResolution = bitResolution;
+        updatePacketSize();
+    }
+}
+
+void JackTripClient::updatePacketSize() {
+    auto channelSize{channelBytes(packetHeader.BitResolution, packetHeader.BufferSize)};
+    udpPacketSize = PACKET_HEADER_SIZE + kNumSendChannels * channelSize;
+
+    // Allow for a DTX bitmask, if silent channels might be left out.
+    auto overhead{IP_UDP_HEADER_SIZE + (dtx ? dtxMaskSize(kNumSendChannels) : 0)};
+    channelsPerPacket = kNumSendChannels;
+    if (mtu > 0 && udpPacketSize + overhead > mtu) {
+        auto room{static_cast<int>(mtu) - overhead - static_cast<int>(PACKET_HEADER_SIZE + SUB_STREAM_HEADER_SIZE)};
+        // If not even one channel fits, send one per packet and let IP
+        // fragment them.
+        channelsPerPacket = max(1, room / channelSize);
+    }
+}
+
+void JackTripClient::configureServerBufferSize(uint16_t bufferSize) {
+    serverBufferSize = bufferSize;
+    reassemblyOpen = false;
+    // The audio interrupt may be reading from the receive buffer.
+    audioBuffer.requestReset(max(bufferSize, static_cast<uint16_t>(AUDIO_BLOCK_SAMPLES)) * BUFFER_PERIODS);
+
+    if (requestedSendPacketSize == 0) {
+        configureSendPacketSize(bufferSize);
+    }
+
+    if (showStats) {
+        Serial.printf("JackTripClient: Server buffer size is %d samples\n", bufferSize);
+    }
+}
+
+void JackTripClient::configureSendPacketSize(uint16_t numSamples) {
+    if (numSamples == packetHeader.BufferSize) {
+        return;
+    }
+
+    packetHeader.BufferSize = numSamples;
+    updatePacketSize();
+    sendBuffer.setLength(max(numSamples, static_cast<uint16_t>(AUDIO_BLOCK_SAMPLES)) * BUFFER_PERIODS);
+    sendBlockFill = 0;
+}
+
+void JackTripClient::configureSamplingRate(uint8_t samplingRate) {
+    auto serverRate{samplingRateToHz(samplingRate)};
+    if (serverRate == 0.f) {
+        return;
+    }
+
+    packetHeader.SamplingRate = samplingRate;
+
+    auto ratio{serverRate / AUDIO_SAMPLE_RATE_EXACT};
+    auto wasResampling{resampling};
+    resampling = fabsf(ratio - 1.f) > MAX_UNRESAMPLED_RATIO;
+
+    if (resampling) {
+        audioBuffer.requestReset(0, ratio);
+        sendBuffer.setFixedIncrement(1.f / ratio);
+        if (!wasResampling) {
+            sendBuffer.clear();
+            sendBlockFill = 0;
         }
+    } else {
+        audioBuffer.requestReset(0, 1.f);
+        sendBuffer.setFixedIncrement(1.f);
+        if (wasResampling) {
+            sendBuffer.clear();
+            sendBlockFill = 0;
+        }
+    }
+
+    auto newRatio{resampling ? ratio : 1.f};
+    if (newRatio != samplingRatio) {
+        samplingRatio = newRatio;
+        applyInterpolation(currentInterpolation);
+        applyMaxLatency();
+    }
+
+    if (showStats && resampling != wasResampling) {
+        Serial.printf("JackTripClient: Server sampling rate is %.0f Hz; %s\n",
+                      serverRate, resampling ? "resampling" : "not resampling");
     }
 }
 
 void JackTripClient::doAudioOutputFromAudio() {
     audioBuffer.read(audioBlock, AUDIO_BLOCK_SAMPLES);
-    audio_block_t *outBlock[kNumChannels];
-    for (int ch = 0; ch < kNumChannels; ++ch) {
+    audio_block_t *outBlock[kNumReceiveChannels];
+    for (int ch = 0; ch < kNumReceiveChannels; ++ch) {
         outBlock[ch] = allocate();
         if (outBlock[ch]) {
             // Copy the samples to the output block.
@@ -344,20 +1075,223 @@ void JackTripClient::doAudioOutputFromAudio() {
     }
 }
 
-bool JackTripClient::isExitPacket() {
-    uint8_t packet[EXIT_PACKET_SIZE];
-    if (read(packet, EXIT_PACKET_SIZE) == EXIT_PACKET_SIZE) {
-        for (size_t i = 0; i < EXIT_PACKET_SIZE; ++i) {
-            if (packet[i] != 0xff) {
-                return false;
-            }
+bool JackTripClient::isExitPacket(const uint8_t *header) {
+    for (size_t i = 0; i < PACKET_HEADER_SIZE; ++i) {
+        if (header[i] != 0xff) {
+            return false;
+        }
+    }
+
+    // No audio packet has a header like that, so the rest may be consumed.
+    uint8_t rest[EXIT_PACKET_SIZE - PACKET_HEADER_SIZE];
+    if (read(rest, sizeof(rest)) != sizeof(rest)) {
+        return false;
+    }
+    for (auto byte: rest) {
+        if (byte != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool JackTripClient::isNewSequence(uint16_t seq, bool split) const {
+    if (lastReceivedSeq >= 0) {
+        // Parts of a split block share a sequence number. Further behind
+        // than the window, assume the server has restarted.
+        auto delta{static_cast<int16_t>(seq - lastReceivedSeq)};
+        if ((delta == 0 && !split) || (delta < 0 && delta >= -SEQUENCE_WINDOW)) {
+            return false;
         }
-        return true;
     }
-    return false;
+    return true;
 }
 
 void JackTripClient::setShowStats(bool show, uint16_t intervalMS) {
     showStats = show;
     packetStats.setPrintInterval(intervalMS);
 }
+
+void JackTripClient::setMaxLatency(float maxLatencyMS) {
+    maxLatency = max(maxLatencyMS, 0.f);
+    applyMaxLatency();
+}
+
+void JackTripClient::applyMaxLatency() {
+    if (maxLatency < 0.f) {
+        return;
+    }
+    // The receive buffer holds samples at the server's rate.
+    audioBuffer.setMaxLatency(maxLatency * AUDIO_SAMPLE_RATE_EXACT * samplingRatio / 1000.f);
+}
+
+void JackTripClient::setCatchUp(uint8_t maxBurst, bool crossfade) {
+    catchUpBurst = maxBurst;
+    catchUpCrossfade = crossfade;
+}
+
+void JackTripClient::setServerSamplingRate(samplingRateT samplingRate) {
+    configureSamplingRate(samplingRate);
+}
+
+void JackTripClient::setBitResolution(audioBitResolutionT resolution) {
+    configureBitResolution(resolution * 8);
+}
+
+void JackTripClient::setMulticast(IPAddress group, uint8_t first, uint8_t numStreamChannels) {
+    multicast = true;
+    multicastGroup = group;
+    firstChannel = first;
+    multicastPacketSize = PACKET_HEADER_SIZE + numStreamChannels * MAX_BUFFER_SIZE * BIT16;
+}
+
+void JackTripClient::setSendPacketSize(uint16_t numSamples) {
+    if (numSamples > MAX_BUFFER_SIZE) {
+        Serial.printf("JackTripClient: Send packet size %d exceeds maximum of %d samples\n",
+                      numSamples, MAX_BUFFER_SIZE);
+        return;
+    }
+
+    noNetworkInterrupts();
+    requestedSendPacketSize = numSamples;
+    configureSendPacketSize(numSamples > 0 ? numSamples : serverBufferSize);
+    networkInterrupts();
+}
+
+void JackTripClient::setBlocksPerPacket(uint8_t numBlocks) {
+    setSendPacketSize(numBlocks * AUDIO_BLOCK_SAMPLES);
+}
+
+void JackTripClient::setMtu(uint16_t mtuBytes) {
+    noNetworkInterrupts();
+    mtu = mtuBytes;
+    updatePacketSize();
+    networkInterrupts();
+}
+
+void JackTripClient::setDtx(bool enable, int16_t threshold) {
+    noNetworkInterrupts();
+    dtx = enable;
+    dtxThreshold = max(threshold, static_cast<int16_t>(0));
+    updatePacketSize();
+    networkInterrupts();
+}
+
+void JackTripClient::setAdpcm(bool enable) {
+    noNetworkInterrupts();
+    sendAdpcm = enable;
+    packetHeader.BitResolution = enable ? ADPCM_BIT_RESOLUTION : receiveResolution;
+    updatePacketSize();
+    networkInterrupts();
+}
+
+void JackTripClient::setSendDriftCompensation(bool enable) {
+    if (enable == compensateSendDrift) {
+        return;
+    }
+
+    noNetworkInterrupts();
+    compensateSendDrift = enable;
+    sendBuffer.clear();
+    sendBlockFill = 0;
+    sendDriftLocked = false;
+    if (!enable) {
+        auto serverRate{samplingRateToHz(packetHeader.SamplingRate)};
+        sendBuffer.setFixedIncrement(serverRate > 0.f ? AUDIO_SAMPLE_RATE_EXACT / serverRate : 1.f);
+    }
+    networkInterrupts();
+}
+
+void JackTripClient::setPlayoutDelay(float delayMS) {
+    noNetworkInterrupts();
+    playoutDelay = static_cast<uint32_t>(max(delayMS, 0.f) * 1000.f);
+    audioBuffer.setScheduledPlayout(playoutDelay > 0);
+    serverClock.reset();
+    networkInterrupts();
+}
+
+void JackTripClient::setTimestampDiscipline(bool enable) {
+    noNetworkInterrupts();
+    disciplineTimestamps = enable;
+    timestampLocked = false;
+    networkInterrupts();
+}
+
+void JackTripClient::setClockSync(uint16_t port, uint16_t intervalMS) {
+    noNetworkInterrupts();
+    clockSyncPort = port;
+    clockSyncInterval = max(intervalMS, static_cast<uint16_t>(1));
+    clockSync.reset();
+    networkInterrupts();
+}
+
+void JackTripClient::setSynchronisedPlayout(bool enable) {
+    noNetworkInterrupts();
+    synchronisedPlayout = enable;
+    // Start again on the new time base.
+    audioBuffer.setScheduledPlayout(playoutDelay > 0);
+    networkInterrupts();
+}
+
+bool JackTripClient::getServerTime(uint64_t &serverTime) {
+    noNetworkInterrupts();
+    auto valid{clockSync.isValid()};
+    if (valid) {
+        serverTime = clockSync.toServer(micros());
+    }
+    networkInterrupts();
+    return valid;
+}
+
+float JackTripClient::getClockSyncAccuracy() {
+    noNetworkInterrupts();
+    auto accuracy{clockSync.getAccuracy()};
+    networkInterrupts();
+    return accuracy;
+}
+
+void JackTripClient::setInterpolation(Interpolation interpolation) {
+    preferredInterpolation = interpolation;
+    applyInterpolation(interpolation);
+}
+
+void JackTripClient::setAutoInterpolation(float maxCpu) {
+    maxCpuPercent = maxCpu;
+    if (maxCpuPercent <= 0.f) {
+        applyInterpolation(preferredInterpolation);
+    }
+}
+
+void JackTripClient::adaptInterpolation() {
+    if (maxCpuPercent <= 0.f || autoInterpolationTimer < AUTO_INTERPOLATION_HOLD_MS) {
+        return;
+    }
+
+    auto usage{AudioProcessorUsage()};
+    auto current{static_cast<int>(currentInterpolation)};
+    if (usage > maxCpuPercent && currentInterpolation > Interpolation::NONE) {
+        applyInterpolation(static_cast<Interpolation>(current - 1));
+    } else if (usage < maxCpuPercent - AUTO_INTERPOLATION_HYSTERESIS &&
+               currentInterpolation < preferredInterpolation) {
+        applyInterpolation(static_cast<Interpolation>(current + 1));
+    } else {
+        return;
+    }
+
+    if (showStats) {
+        Serial.printf("JackTripClient: CPU usage %.1f%%; interpolation %d of %d\n",
+                      usage, static_cast<int>(currentInterpolation), static_cast<int>(preferredInterpolation));
+    }
+}
+
+void JackTripClient::applyInterpolation(Interpolation interpolation) {
+    currentInterpolation = interpolation;
+    audioBuffer.setInterpolation(getValidInterpolation(interpolation, samplingRatio));
+    sendBuffer.setInterpolation(getValidInterpolation(interpolation, 1.f / samplingRatio));
+    autoInterpolationTimer = 0;
+}
+
+JackTripClient::Interpolation JackTripClient::getValidInterpolation(Interpolation interpolation, float ratio) {
+    // Only a band-limited method avoids aliasing when decimating.
+    return ratio > 1.f + MAX_UNRESAMPLED_RATIO ? Interpolation::SINC : interpolation;
+}
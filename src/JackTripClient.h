@@ -14,14 +14,34 @@
 #endif
 
 #include "PacketHeader.h"
-#include "CircularBuffer.h"
 #include "CircularBufferMulti.h"
+#include "ClockEstimator.h"
+#include "ClockSync.h"
 #include "PacketStats.h"
+#include "SampleFormat.h"
 
 #define RECEIVE_CONDITION while
 
 #define JACKTRIP_EXIT_PACKET_SIZE 63
 
+/**
+ * Largest server buffer size, and send packet size, to support, in samples;
+ * by default, AUDIO_BLOCK_SAMPLES. Receive and send buffers are allocated for
+ * this size, so raise it only to exchange larger packets.
+ */
+#ifndef JACKTRIP_MAX_BUFFER_SIZE
+#define JACKTRIP_MAX_BUFFER_SIZE AUDIO_BLOCK_SAMPLES
+#endif
+
+/**
+ * Widest wire format to support, in bits per sample: 16, 24 or 32. Packet
+ * buffers are allocated for this resolution; the server's packets at any
+ * wider resolution are dropped.
+ */
+#ifndef JACKTRIP_MAX_BIT_RESOLUTION
+#define JACKTRIP_MAX_BIT_RESOLUTION 16
+#endif
+
 #define JACKTRIPCLIENT_DEBUG
 #undef JACKTRIPCLIENT_DEBUG
 
@@ -29,12 +49,103 @@
  * Inputs: signals produced by other audio components, to be sent to peers over
  *   the JackTrip protocol to do with as they will.
  * Outputs: audio signals received over the JackTrip protocol.
+ * The numbers of inputs and outputs may differ.
  */
 class JackTripClient : public AudioStream, EthernetUDP {
 public:
+    using DriftMode = CircularBufferMulti<int16_t>::DriftMode;
+    using Interpolation = CircularBufferMulti<int16_t>::Interpolation;
+
+    /**
+     * Progress of the handshake with the server, as advanced by poll().
+     */
+    enum class ConnectionState : uint8_t {
+        /**
+         * Not connected; waiting out the backoff before the next attempt.
+         */
+        WAITING,
+        /**
+         * Sent the local UDP port to the server over TCP; waiting for the
+         * server's in return.
+         */
+        AWAITING_PORT,
+        CONNECTED
+    };
+
+    /**
+     * Outcome of validating the most recently received packet.
+     */
+    enum class ReceiveStatus : uint8_t {
+        OK,
+        /**
+         * The server sends a different number of channels; surplus channels
+         * are dropped and missing ones are silent.
+         */
+        CHANNEL_MISMATCH,
+        /**
+         * Shorter than a header.
+         */
+        BAD_PACKET_SIZE,
+        /**
+         * Packet length doesn't match that implied by its header.
+         */
+        SIZE_MISMATCH,
+        /**
+         * Server buffer size is zero or exceeds JACKTRIP_MAX_BUFFER_SIZE.
+         */
+        UNSUPPORTED_BUFFER_SIZE,
+        UNSUPPORTED_SAMPLING_RATE,
+        /**
+         * Not a JackTrip resolution, or wider than
+         * JACKTRIP_MAX_BIT_RESOLUTION.
+         */
+        UNSUPPORTED_BIT_RESOLUTION,
+        /**
+         * A sub-stream's channels lie outside the block it's part of.
+         */
+        BAD_SUB_STREAM,
+        /**
+         * From an address or port other than the server's.
+         */
+        FOREIGN_SOURCE,
+        /**
+         * A duplicate, or older than the latest packet; dropped unread.
+         */
+        STALE,
+        /**
+         * The server's buffer size, sampling rate or bit resolution has
+         * changed, but not yet on enough consecutive packets to adapt to it.
+         */
+        FORMAT_CHANGE
+    };
+
+    /**
+     * @param numChannels number of channels to send and receive.
+     * @param serverIpAddress IP address of the JackTrip server.
+     * @param serverTcpPort JackTrip server's TCP port.
+     * @param driftMode how the receive buffer should compensate for clock
+     * drift; INSERT_DELETE is cheaper for large channel counts.
+     */
     JackTripClient(uint8_t numChannels,
                    IPAddress &serverIpAddress,
-                   uint16_t serverTcpPort = 4464);
+                   uint16_t serverTcpPort = 4464,
+                   DriftMode driftMode = DriftMode::INTERPOLATE);
+
+    /**
+     * @param numReceiveChannels number of channels to receive from the
+     * server, i.e. outputs.
+     * @param numSendChannels number of channels to send to the server, i.e.
+     * inputs.
+     * @param serverIpAddress IP address of the JackTrip server.
+     * @param serverTcpPort JackTrip server's TCP port.
+     * @param driftMode how the receive buffer should compensate for clock
+     * drift; INSERT_DELETE is cheaper for large channel counts.
+     */
+    JackTripClient(uint8_t numReceiveChannels,
+                   uint8_t numSendChannels,
+                   IPAddress &serverIpAddress,
+                   uint16_t serverTcpPort = 4464,
+                   DriftMode driftMode = DriftMode::INTERPOLATE);
 
     virtual ~JackTripClient();
 
@@ -48,17 +159,236 @@ public:
     bool isConnected() const;
 
     /**
-     * Connect the client to the server.
-     * @param timeout
+     * Connect the client to the server now, waiting for the outcome. poll()
+     * does the same without holding up loop().
+     * @param timeout TCP connection timeout, in milliseconds.
      * @return <em>true</em> on success, <em>false</em> on failure.
      */
     bool connect(uint16_t timeout = 1000);
 
+    /**
+     * Disconnect from the server, abandoning any handshake in progress.
+     * poll() reconnects after MIN_RECONNECT_BACKOFF_MS.
+     */
     void stop() override;
 
+    /**
+     * Do work that mustn't hold up the audio interrupt, e.g. building
+     * resampling filters and exchanges with a clock sync responder, and
+     * connect to the server, reconnecting whenever
+     * the connection is lost. Failed attempts are retried with exponential
+     * backoff, and the wait for the server's reply is spread over calls, so
+     * loop() keeps running while the server is down. Call from loop().
+     */
+    void poll();
+
+    ConnectionState getConnectionState() const { return connectionState; };
+
     void setShowStats(bool show, uint16_t intervalMS = 1'000);
 
-    uint16_t getNumChannels() const { return kNumChannels; };
+    /**
+     * Set an upper bound on receive latency. If the receive buffer backs up
+     * beyond this, playback skips forward to the buffer's target delay.
+     * @param maxLatencyMS maximum latency in milliseconds; 0 to disable.
+     */
+    void setMaxLatency(float maxLatencyMS);
+
+    /**
+     * After a network stall, the backlog of queued packets arrives in a
+     * burst. Rather than play all of it, raising latency by the length of
+     * the stall, skip to the receive buffer's target delay behind the newest
+     * audio whenever more than a given number of packets arrive at once,
+     * beyond those expected per audio block, and more than that many packets'
+     * worth of audio is queued beyond the target delay. Skipped samples are
+     * counted in the packet stats.
+     * @param maxBurst packets beyond one audio block's worth that may arrive
+     * at once, and be queued; 0 to disable.
+     * @param crossfade whether to crossfade across the skip, rather than cut.
+     */
+    void setCatchUp(uint8_t maxBurst, bool crossfade = true);
+
+    /**
+     * Set the sampling rate at which the JackTrip server is expected to run,
+     * to be reported in outgoing packets before anything has been received.
+     * Once a packet arrives, the rate in its header takes precedence. If the
+     * server's rate differs from Teensy's, audio is resampled in both
+     * directions.
+     */
+    void setServerSamplingRate(samplingRateT samplingRate);
+
+    /**
+     * Set the bit resolution with which to send audio before anything has
+     * been received. Once a packet arrives, the resolution in its header
+     * takes precedence, and is used in both directions. Audio is converted
+     * to and from Teensy's 16-bit samples. Resolutions wider than
+     * JACKTRIP_MAX_BIT_RESOLUTION are ignored.
+     */
+    void setBitResolution(audioBitResolutionT resolution);
+
+    /**
+     * Receive from a multicast group rather than from a JackTrip server, e.g.
+     * so that one wide multichannel stream serves a whole speaker array, each
+     * client taking its own range of channels. Call before begin(), which
+     * then joins the group; connect() doesn't contact a server, and nothing
+     * is sent.
+     * @param group multicast group address.
+     * @param first index of the first channel of the stream to receive;
+     * subsequent channels are received up to the client's receive channel
+     * count.
+     * @param numStreamChannels channels in the stream, to size the socket
+     * for packets of 16-bit samples up to JACKTRIP_MAX_BUFFER_SIZE.
+     */
+    void setMulticast(IPAddress group, uint8_t first, uint8_t numStreamChannels);
+
+    /**
+     * Set the number of samples per channel in each packet sent, independent
+     * of AUDIO_BLOCK_SAMPLES; outgoing audio is re-blocked accordingly. By
+     * default, packets are sent at the server's buffer size once known, or at
+     * AUDIO_BLOCK_SAMPLES until then.
+     * @param numSamples samples per packet, up to JACKTRIP_MAX_BUFFER_SIZE; 0
+     * to follow the server.
+     */
+    void setSendPacketSize(uint16_t numSamples);
+
+    /**
+     * Send several audio blocks per packet, so that AUDIO_BLOCK_SAMPLES may be
+     * small, for low local processing latency, without a correspondingly
+     * high packet rate. Equivalent to
+     * setSendPacketSize(numBlocks * AUDIO_BLOCK_SAMPLES). To receive several
+     * blocks per packet, set the server's buffer size accordingly.
+     * @param numBlocks blocks per packet; 0 to follow the server.
+     */
+    void setBlocksPerPacket(uint8_t numBlocks);
+
+    /**
+     * Send audio IMA-ADPCM-coded at 4 bits per sample, regardless of the
+     * resolution received, to fit four times as many channels per link as
+     * 16-bit audio. JackTrip itself doesn't decode ADPCM, so the receiving end
+     * must (see scripts/adpcm.py). Received ADPCM packets are decoded whatever
+     * this setting.
+     */
+    void setAdpcm(bool enable);
+
+    /**
+     * Keep outgoing packets within a given MTU, so that they aren't
+     * fragmented, by splitting each block's channels across several packets
+     * with the same sequence number. Packets that already fit are sent as
+     * usual. JackTrip itself doesn't reassemble split packets, so the
+     * receiving end must: another JackTripClient, or a stand-in such as
+     * scripts/multicast-sender.py. Incoming split packets are reassembled
+     * whatever this setting.
+     * @param mtu maximum size, in bytes, of IP packets on the link, typically
+     * 1500; 0 to disable.
+     */
+    void setMtu(uint16_t mtu);
+
+    /**
+     * Discontinuous transmission: leave channels that are silent for a whole
+     * packet out of it, flagging which are present in a bitmask after the
+     * header. Packets with no silent channels are sent as usual, and a packet
+     * is still sent when every channel is silent, so the receiver keeps
+     * time. As with setMtu(), the receiving end must expand such packets:
+     * another JackTripClient, or a stand-in such as
+     * scripts/jacktrip-expander.py. Incoming DTX packets are expanded
+     * whatever this setting.
+     * @param threshold largest sample magnitude to treat as silence; 0 for
+     * digital silence only.
+     */
+    void setDtx(bool enable, int16_t threshold = 0);
+
+    /**
+     * Resample outgoing audio to follow the server's clock, as estimated from
+     * the rate at which received audio is consumed, so that packets reach the
+     * server at its own sampling rate rather than Teensy's. Without this, the
+     * server's receive queue slowly fills or empties.
+     */
+    void setSendDriftCompensation(bool enable);
+
+    /**
+     * Play each received block a fixed time after its server timestamp, as
+     * mapped to the local clock, rather than as soon as arrival jitter
+     * allows. Latency is then deterministic, and the same for every client
+     * given the same delay and network path. The delay is relative to the
+     * earliest arrivals, so should exceed the expected arrival jitter, and is
+     * limited by the length of the receive buffer.
+     * @param delayMS delay in milliseconds; 0 to disable.
+     */
+    void setPlayoutDelay(float delayMS);
+
+    /**
+     * Outgoing timestamps are derived from the number of samples sent, so
+     * advance smoothly at the sample clock's rate. Optionally, discipline
+     * them to the server's clock, as estimated from received timestamps: the
+     * sample clock's rate is scaled by the measured skew, and any remaining
+     * error is slewed out gradually, or stepped out if large. Timestamps
+     * then track the server's, less the minimum network delay.
+     */
+    void setTimestampDiscipline(bool enable);
+
+    /**
+     * Keep an estimate of a server's clock by two-way timestamp exchanges,
+     * over this client's UDP socket, with a responder at the server's
+     * address, such as scripts/clock-sync-responder.py. Requests are sent
+     * from poll(); responses are taken as they arrive alongside audio. Since
+     * responses are only seen at audio updates, the exchange with the
+     * shortest round trip in every two seconds is used.
+     * @param port the responder's UDP port; 0 to disable.
+     * @param intervalMS time between requests, in milliseconds; longer
+     * intervals leave fewer exchanges per window, so a less accurate fit.
+     */
+    void setClockSync(uint16_t port, uint16_t intervalMS = 10);
+
+    /**
+     * Get the server's time, in microseconds, as estimated via clock sync.
+     * @return <em>true</em> if there is an estimate, <em>false</em> if not.
+     */
+    bool getServerTime(uint64_t &serverTime);
+
+    /**
+     * Get the estimated accuracy of getServerTime(), in microseconds; see
+     * ClockSync::getAccuracy().
+     */
+    float getClockSyncAccuracy();
+
+    /**
+     * With setPlayoutDelay(), play each received block a fixed delay after
+     * its server timestamp as estimated via setClockSync(), rather than after
+     * its earliest expected arrival. Every client synchronised to the same
+     * responder then plays a given block at the same instant, whatever its
+     * network path. The delay must therefore exceed the longest network delay
+     * of any client, plus jitter. The server's timestamps must be on the
+     * responder's clock, as with scripts/multicast-sender.py and
+     * scripts/clock-sync-responder.py on the same host; blocks whose
+     * timestamps are implausibly far from it are played unscheduled.
+     */
+    void setSynchronisedPlayout(bool enable);
+
+    /**
+     * Set the interpolation method with which to read received audio, and to
+     * resample outgoing audio. Changes are crossfaded, so may be made while
+     * running. While resampling, whichever buffer decimates, i.e. receive
+     * from a faster server or send to a slower one, uses Interpolation::SINC
+     * regardless, as other methods alias.
+     */
+    void setInterpolation(Interpolation interpolation);
+
+    /**
+     * While AudioProcessorUsage() exceeds a threshold, step the interpolation
+     * method down, as far as Interpolation::NONE; once usage has dropped well
+     * below the threshold, step back up to the method last set via
+     * setInterpolation(). A buffer that decimates keeps Interpolation::SINC.
+     * @param maxCpuPercent threshold; 0 to disable.
+     */
+    void setAutoInterpolation(float maxCpuPercent);
+
+    uint16_t getNumReceiveChannels() const { return kNumReceiveChannels; };
+
+    uint16_t getNumSendChannels() const { return kNumSendChannels; };
+
+    /**
+     * Get the result of validating the most recently received packet.
+     */
+    ReceiveStatus getReceiveStatus() const { return receiveStatus; };
 
 private:
     struct TimeStampStruct {
@@ -67,16 +397,114 @@ private:
     };
     static constexpr uint32_t RECEIVE_TIMEOUT_MS{10'000};
     /**
-     * Size in bytes of one channel's worth of samples.
+     * TCP connection timeout, in milliseconds, for attempts made by poll().
+     * NativeEthernet's connect() blocks until it succeeds or times out, so
+     * this bounds how long an unreachable server holds up loop().
+     */
+    static constexpr uint16_t CONNECT_TIMEOUT_MS{100};
+    /**
+     * Time, in milliseconds, to wait for the server's UDP port once the local
+     * port has been sent, before giving up on the attempt.
+     */
+    static constexpr uint32_t PORT_REPLY_TIMEOUT_MS{2000};
+    /**
+     * Wait, in milliseconds, before reconnecting after the connection is
+     * lost, or after a failed attempt; doubled with each further failure, up
+     * to MAX_RECONNECT_BACKOFF_MS.
+     */
+    static constexpr uint32_t MIN_RECONNECT_BACKOFF_MS{250};
+    static constexpr uint32_t MAX_RECONNECT_BACKOFF_MS{8000};
+    /**
+     * Deviation of the server:client sampling rate ratio from unity below
+     * which to treat it as clock drift rather than a different sampling rate.
+     */
+    static constexpr float MAX_UNRESAMPLED_RATIO{.01f};
+    /**
+     * Relative change in send increment per sample sent in excess of those
+     * received, when compensating for drift.
+     */
+    static constexpr float SEND_DRIFT_CORRECTION{2e-6f};
+    /**
+     * Percentage by which CPU usage must fall below the threshold given to
+     * setAutoInterpolation() before interpolation quality is raised again.
+     */
+    static constexpr float AUTO_INTERPOLATION_HYSTERESIS{10.f};
+    /**
+     * Minimum time, in milliseconds, between automatic changes of
+     * interpolation method, so that CPU usage reflects the last change.
+     */
+    static constexpr uint32_t AUTO_INTERPOLATION_HOLD_MS{2000};
+    /**
+     * Minimum time, in milliseconds, between diagnostics about received
+     * packets, so that printing doesn't itself cause dropouts.
+     */
+    static constexpr uint32_t RECEIVE_STATUS_INTERVAL_MS{5000};
+    /**
+     * Number of sequence numbers behind the latest within which a packet is
+     * treated as late and dropped; further behind, as from a restarted
+     * server.
+     */
+    static constexpr int16_t SEQUENCE_WINDOW{64};
+    /**
+     * Number of consecutive packets that must agree on a new buffer size,
+     * sampling rate or bit resolution before the client adapts to it, so
+     * that one corrupt header can't reconfigure it.
+     */
+    static constexpr uint8_t FORMAT_CHANGE_PACKETS{2};
+    /**
+     * Fraction of the error between outgoing timestamps and estimated server
+     * time removed per packet sent, when disciplining timestamps.
+     */
+    static constexpr double TIMESTAMP_DISCIPLINE_GAIN{1. / 1024.};
+    /**
+     * Error, in microseconds, beyond which disciplined timestamps are stepped
+     * to estimated server time rather than slewed.
+     */
+    static constexpr int64_t TIMESTAMP_STEP_THRESHOLD{10'000};
+    /**
+     * Distance, in microseconds, between now and a block's synchronised
+     * playout time beyond which to assume the server's timestamps aren't on
+     * the clock sync responder's clock.
+     */
+    static constexpr int32_t MAX_SYNCHRONISED_LEAD{1'000'000};
+    /**
+     * Size in bytes of one channel's worth of 16-bit samples.
      */
     static constexpr uint16_t CHANNEL_FRAME_SIZE{AUDIO_BLOCK_SAMPLES * sizeof(uint16_t)};
+    static constexpr uint16_t MAX_BUFFER_SIZE{
+            JACKTRIP_MAX_BUFFER_SIZE > AUDIO_BLOCK_SAMPLES ? JACKTRIP_MAX_BUFFER_SIZE : AUDIO_BLOCK_SAMPLES};
+    /**
+     * Length of the receive and send buffers, as a multiple of the larger of
+     * the packet size and AUDIO_BLOCK_SAMPLES.
+     */
+    static constexpr uint8_t BUFFER_PERIODS{8};
+    /**
+     * Largest number of bytes per sample in any supported wire format.
+     */
+    static constexpr uint8_t MAX_SAMPLE_SIZE{
+            JACKTRIP_MAX_BIT_RESOLUTION > BIT16 * 8 ? JACKTRIP_MAX_BIT_RESOLUTION / 8 : BIT16};
     /**
      * Size, in bytes, of JackTrip's exit packet
      */
     static constexpr uint8_t EXIT_PACKET_SIZE{JACKTRIP_EXIT_PACKET_SIZE};
+    /**
+     * Size, in bytes, of the IPv4 and UDP headers that precede a packet on
+     * the link.
+     */
+    static constexpr uint8_t IP_UDP_HEADER_SIZE{28};
+    /**
+     * Size, in bytes, of the DTX bitmask for the largest possible number of
+     * channels.
+     */
+    static constexpr uint8_t MAX_DTX_MASK_SIZE{(UINT8_MAX + 7) / 8};
 
-    const uint8_t kNumChannels;
-    const uint32_t kUdpPacketSize;
+    const uint8_t kNumReceiveChannels;
+    const uint8_t kNumSendChannels;
+    /**
+     * Size of a packet at the largest supported buffer size and bit
+     * resolution.
+     */
+    const uint32_t kMaxUdpPacketSize;
     const uint32_t kAudioPacketSize;
 
     /**
@@ -96,22 +524,211 @@ private:
      */
     int receivePackets();
 
+    /**
+     * Check the header of the packet just received against its size, and
+     * against the client's configuration, adopting the server's buffer size,
+     * sampling rate and bit resolution once they've changed on
+     * FORMAT_CHANGE_PACKETS consecutive packets. Allocates nothing.
+     * @param size packet size in bytes, less any sub-stream header and DTX
+     * bitmask.
+     * @param subStream the packet's sub-stream header, if it has one;
+     * otherwise zeros, and set to cover the whole packet.
+     * @param presenceMask the packet's DTX bitmask, or nullptr if all its
+     * channels are present.
+     * @param numChannels set to the number of channels in the packet.
+     */
+    ReceiveStatus validatePacket(int size, JackTripSubStreamHeader &subStream, const uint8_t *presenceMask,
+                                 uint8_t &numChannels);
+
+    /**
+     * Unpack channels of a packet that holds part of a block into the
+     * reassembly block, playing the block once all of this client's channels
+     * have arrived, or once a packet of a later block arrives.
+     * @param channelData the packet's audio for each of this client's
+     * channels; nullptr for silent channels.
+     * @param first index, among this client's channels, of the first channel
+     * in the packet.
+     * @param numChannels number of this client's channels in the packet.
+     * @param totalChannels number of channels in the whole block.
+     * @param arrival value of micros() when the packet arrived.
+     */
+    void receiveSubStream(const uint8_t **channelData, int first, int numChannels, uint8_t totalChannels,
+                          uint32_t arrival);
+
+    /**
+     * Play the block being reassembled; channels that haven't arrived are
+     * silent.
+     */
+    void flushReassembly();
+
+    /**
+     * Write a received block to the audio buffer, and update statistics.
+     * @param audio one block of samples per receive channel.
+     * @param header the header of the block's packet.
+     * @param arrival value of micros() when the packet arrived.
+     */
+    void writeReceivedBlock(const int16_t **audio, JackTripPacketHeader &header, uint32_t arrival);
+
+    /**
+     * Record the status of a received packet. Changes of status, and counts
+     * of dropped packets, are printed at most every
+     * RECEIVE_STATUS_INTERVAL_MS.
+     */
+    void setReceiveStatus(ReceiveStatus status);
+
+    static const char *describe(ReceiveStatus status);
+
+    /**
+     * Check whether a bit resolution is supported, and no wider than
+     * JACKTRIP_MAX_BIT_RESOLUTION.
+     */
+    static bool isAllowedResolution(uint8_t bitResolution);
+
+    /**
+     * Read and discard bytes from the current packet.
+     * @param scratch somewhere to read them to.
+     */
+    void discard(int numBytes, uint8_t *scratch, int scratchSize);
+
     /**
      * Check whether a packet received from the JackTrip server is an exit
-     * packet.
-     * @return
+     * packet, reading the rest of it only if its header matches, so that an
+     * audio packet isn't consumed.
+     * @param header the packet's first PACKET_HEADER_SIZE bytes, already
+     * read.
+     */
+    bool isExitPacket(const uint8_t *header);
+
+    /**
+     * Check a received packet's sequence number against the latest, before
+     * reading its audio. The latest is updated only once the packet has
+     * passed validatePacket(), so that a malformed packet can't cause valid
+     * ones to be dropped as stale.
+     * @param split whether the packet holds part of a block, so may share
+     * its sequence number with others.
+     * @return <em>false</em> if the packet is a duplicate or out of date.
      */
-    bool isExitPacket();
+    bool isNewSequence(uint16_t seq, bool split) const;
 
     /**
-     * Send a JackTrip packet containing audio routed to this object's inputs.
+     * Send audio routed to this object's inputs to the server, resampling to
+     * the server's sampling rate, or clock, if necessary.
      */
-    void sendPacket();
+    void sendAudio();
 
     /**
-     * Copy audio samples from incoming UDP data to Teensy audio output.
+     * Send a JackTrip packet containing one block of audio.
+     * @param audio one block of samples per channel.
      */
-    void doAudioOutputFromUDP();
+    void sendPacket(const int16_t **audio);
+
+    /**
+     * Send one UDP packet to the server.
+     */
+    void sendDatagram(const uint8_t *data, size_t size);
+
+    /**
+     * Set the send buffer's read increment such that outgoing audio is
+     * produced at the rate at which the server's audio is consumed.
+     */
+    void updateSendIncrement();
+
+    /**
+     * Step interpolation quality down or up according to CPU usage, if
+     * enabled via setAutoInterpolation().
+     */
+    void adaptInterpolation();
+
+    void applyInterpolation(Interpolation interpolation);
+
+    /**
+     * Convert maxLatency to samples at the server's rate, and apply it to the
+     * receive buffer, if set.
+     */
+    void applyMaxLatency();
+
+    /**
+     * Get the method with which to read a buffer at a given write:read ratio:
+     * interpolation, unless the buffer decimates.
+     */
+    static Interpolation getValidInterpolation(Interpolation interpolation, float ratio);
+
+    /**
+     * Schedule the block just written to the audio buffer for playout
+     * playoutDelay after its server timestamp, as mapped to local time by
+     * serverClock, or by clockSync if synchronising playout.
+     */
+    void schedulePlayout(const JackTripPacketHeader &header);
+
+    /**
+     * Advance packetHeader.TimeStamp by one packet's worth of samples.
+     */
+    void advanceTimestamp();
+
+    /**
+     * Send a clock sync request, from poll().
+     */
+    void sendClockSyncRequest();
+
+    /**
+     * Hold off the contexts that send and receive, i.e. the audio interrupt
+     * and, with USE_TIMER, the timer's, while changing state they share.
+     * AudioNoInterrupts() alone doesn't hold off the timer.
+     */
+    static void noNetworkInterrupts();
+
+    static void networkInterrupts();
+
+    /**
+     * Advance the handshake with the server by one step, if one is due.
+     * @param timeout TCP connection timeout, in milliseconds.
+     */
+    void advanceConnection(uint16_t timeout);
+
+    /**
+     * Open a TCP connection to the server and send it the local UDP port.
+     */
+    void startHandshake(uint16_t timeout);
+
+    /**
+     * Check for the server's UDP port in reply to startHandshake().
+     */
+    void awaitServerPort();
+
+    /**
+     * Abandon the current attempt to connect, and back off before the next.
+     */
+    void retryConnection();
+
+    /**
+     * Set up resampling, if necessary, for a given server sampling rate.
+     */
+    void configureSamplingRate(uint8_t samplingRate);
+
+    /**
+     * Size the receive buffer for the server's buffer size and, unless set
+     * via setSendPacketSize(), send packets of the same size.
+     */
+    void configureServerBufferSize(uint16_t bufferSize);
+
+    /**
+     * Set the number of samples per channel in outgoing packets.
+     */
+    void configureSendPacketSize(uint16_t numSamples);
+
+    /**
+     * Set the wire format of audio in both directions, unless sending ADPCM.
+     * @param bitResolution bits per sample; ignored if not supported.
+     */
+    void configureBitResolution(uint8_t bitResolution);
+
+    /**
+     * Set the size of outgoing packets according to the send packet size and
+     * bit resolution, and the number of channels per packet according to the
+     * MTU.
+     */
+    void updatePacketSize();
+
     void doAudioOutputFromAudio();
 
     /**
@@ -137,11 +754,58 @@ private:
 
     /*volatile*/ bool connected{false};
 
+    ConnectionState connectionState{ConnectionState::WAITING};
+    /**
+     * TCP connection to the server for the handshake.
+     */
+    EthernetClient handshakeClient;
+    /**
+     * Time since entering the current ConnectionState.
+     */
+    elapsedMillis connectionTimer{0};
+    /**
+     * Wait, in milliseconds, before the next attempt to connect; 0 to attempt
+     * straight away.
+     */
+    uint32_t reconnectBackoff{0};
+
+    /**
+     * Whether to receive from a multicast group rather than a server.
+     */
+    bool multicast{false};
+    IPAddress multicastGroup;
+    /**
+     * Size of the largest expected multicast packet.
+     */
+    uint32_t multicastPacketSize{0};
+    /**
+     * Index of the first channel of received packets to play.
+     */
+    uint8_t firstChannel{0};
+
     elapsedMillis lastReceive{0};
 
+    /**
+     * Packets, beyond those expected per audio block, that may arrive in one
+     * call to receivePackets() before catching up; 0 not to.
+     */
+    uint8_t catchUpBurst{0};
+    /**
+     * Maximum receive latency set via setMaxLatency(), in milliseconds;
+     * negative if not set, leaving the receive buffer's default.
+     */
+    float maxLatency{-1.f};
+    bool catchUpCrossfade{true};
+    /**
+     * Blocks of audio written in the current call to receivePackets().
+     */
+    uint16_t burstLength{0};
+
     /**
      * The header to send with every outgoing JackTrip packet.
      * TimeStamp and SeqNumber should be incremented accordingly.
+     * As in JackTrip, NumIncomingChannelsFromNet is the number of channels in
+     * the packet, and NumOutgoingChannelsToNet the number wanted in return.
      */
     JackTripPacketHeader packetHeader{
             0,
@@ -149,21 +813,196 @@ private:
             AUDIO_BLOCK_SAMPLES,
             samplingRateT::SR44,
             16,
-            kNumChannels,
-            kNumChannels
+            kNumSendChannels,
+            kNumReceiveChannels
     };
 
-    elapsedMicros packetInterval{0};
+    /**
+     * Bit resolution of received audio; that of outgoing audio is
+     * packetHeader.BitResolution.
+     */
+    uint8_t receiveResolution{BIT16 * 8};
+    /**
+     * Whether to send ADPCM whatever the resolution received.
+     */
+    bool sendAdpcm{false};
+    /**
+     * Size of an outgoing packet at the current buffer size and bit
+     * resolution.
+     */
+    uint32_t udpPacketSize;
+    /**
+     * MTU within which to keep outgoing packets; 0 not to split them.
+     */
+    uint16_t mtu{0};
+    /**
+     * Channels per outgoing packet; fewer than kNumSendChannels if packets
+     * are split to fit the MTU.
+     */
+    uint8_t channelsPerPacket;
+    /**
+     * Whether to leave silent channels out of outgoing packets, and the
+     * largest sample magnitude to treat as silence.
+     */
+    bool dtx{false};
+    int16_t dtxThreshold{0};
+    /**
+     * Samples per channel in the server's packets.
+     */
+    uint16_t serverBufferSize{AUDIO_BLOCK_SAMPLES};
+    /**
+     * Samples per channel in outgoing packets, as set by setSendPacketSize();
+     * 0 to follow the server.
+     */
+    uint16_t requestedSendPacketSize{0};
+
+    ReceiveStatus receiveStatus{ReceiveStatus::OK};
+    /**
+     * Status last printed, and the number of packets dropped since.
+     */
+    ReceiveStatus reportedStatus{ReceiveStatus::OK};
+    uint32_t droppedPackets{0};
+    elapsedMillis receiveStatusTimer{RECEIVE_STATUS_INTERVAL_MS};
+
     JackTripPacketHeader prevServerHeader{};
-    JackTripPacketHeader *serverHeader;
+    /**
+     * Header of the latest packet in a new format, and the number of
+     * consecutive packets that have agreed on it.
+     */
+    JackTripPacketHeader pendingFormat{};
+    uint8_t pendingFormatCount{0};
+    /**
+     * Header of the packet being received.
+     */
+    JackTripPacketHeader serverHeader{};
 
 #ifdef USE_TIMER
     TeensyTimerTool::PeriodicTimer timer;
 #endif
 
-    CircularBuffer<uint8_t> udpBuffer;
+    /**
+     * The packet being received, as received; up to kMaxUdpPacketSize bytes.
+     */
+    uint8_t *receivePacketBuffer;
     CircularBufferMulti<int16_t> audioBuffer;
     int16_t **audioBlock;
+    /**
+     * Received audio converted to 16 bits, if sent at another resolution.
+     * Holds up to MAX_BUFFER_SIZE samples per channel.
+     */
+    int16_t **receiveBlock;
+
+    /**
+     * Sequence number of the latest packet received; -1 before any have
+     * been.
+     */
+    int32_t lastReceivedSeq{-1};
+    /**
+     * Sequence number of the block being reassembled from split packets, or
+     * of the last one played; -1 before any have been received.
+     */
+    int32_t reassemblySeq{-1};
+    /**
+     * Whether the block with reassemblySeq is yet to be played.
+     */
+    bool reassemblyOpen{false};
+    /**
+     * Which of this client's channels of the block have arrived, and how
+     * many that the stream carries have yet to.
+     */
+    bool *reassemblyReceived;
+    uint8_t reassemblyPending{0};
+    JackTripPacketHeader reassemblyHeader{};
+    uint32_t reassemblyArrival{0};
+
+    /**
+     * Whether the server runs at a different sampling rate.
+     */
+    bool resampling{false};
+    /**
+     * Server sampling rate relative to Teensy's, if resampling; otherwise 1.
+     */
+    float samplingRatio{1.f};
+    /**
+     * Whether to resample outgoing audio to follow the server's clock.
+     */
+    bool compensateSendDrift{false};
+    /**
+     * Server-rate samples sent since starting.
+     */
+    double samplesSent{0.};
+    /**
+     * Samples sent less samples received when the receive buffer was primed.
+     */
+    double sendDriftOffset{0.};
+    bool sendDriftLocked{false};
+    /**
+     * Outgoing timestamps: microseconds of audio sent, by the sample clock,
+     * since timestampOrigin. Fractional microseconds are kept, so timestamps
+     * don't drift through rounding.
+     */
+    uint64_t timestampOrigin{0};
+    double timestampElapsed{0.};
+    /**
+     * Whether to discipline outgoing timestamps to the server's clock, and
+     * whether they have yet been stepped to it.
+     */
+    bool disciplineTimestamps{false};
+    bool timestampLocked{false};
+    /**
+     * Converts outgoing audio to the server's sampling rate, when resampling
+     * or compensating for drift.
+     */
+    CircularBufferMulti<int16_t> sendBuffer;
+    /**
+     * One outgoing packet's worth of audio, up to MAX_BUFFER_SIZE samples
+     * per channel; sendBlockFill samples of which have been re-blocked so far
+     * when not resampling.
+     */
+    int16_t **sendBlock;
+    /**
+     * Outgoing packet, as assembled by sendPacket(); too big for the stack of
+     * the interrupt that may be sending it.
+     */
+    uint8_t *sendPacketBuffer;
+    uint16_t sendBlockFill{0};
+
+    /**
+     * Maps server timestamps to local time, for scheduled playout and
+     * disciplined timestamps.
+     */
+    ClockEstimator serverClock;
+    /**
+     * Estimates the server's clock from two-way exchanges with a responder on
+     * clockSyncPort, sent every clockSyncInterval milliseconds; 0 if not
+     * synchronising.
+     */
+    ClockSync clockSync;
+    uint16_t clockSyncPort{0};
+    uint16_t clockSyncInterval{10};
+    elapsedMillis clockSyncTimer{0};
+    /**
+     * Delay, in microseconds, between a block's mapped server timestamp and
+     * its playout; 0 when not scheduling playout.
+     */
+    uint32_t playoutDelay{0};
+    /**
+     * Whether to schedule playout against clockSync rather than serverClock.
+     */
+    bool synchronisedPlayout{false};
+    elapsedMillis synchronisedPlayoutWarningTimer{RECEIVE_STATUS_INTERVAL_MS};
+
+    /**
+     * Interpolation method set by setInterpolation().
+     */
+    Interpolation preferredInterpolation{Interpolation::CUBIC};
+    /**
+     * Interpolation method in use; lower than preferredInterpolation if
+     * stepped down to save CPU.
+     */
+    Interpolation currentInterpolation{Interpolation::CUBIC};
+    float maxCpuPercent{0.f};
+    elapsedMillis autoInterpolationTimer{0};
 
     PacketStats packetStats;
     bool showStats{false};
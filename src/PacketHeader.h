@@ -35,4 +35,86 @@ public:
 
 #define PACKET_HEADER_SIZE sizeof(JackTripPacketHeader)
 
+/**
+ * Flag set in BitResolution, by JackTripClient peers only, when a block's
+ * channels are split across several packets. Each such packet has the same
+ * TimeStamp and SeqNumber, NumIncomingChannelsFromNet is the number of
+ * channels in that packet, and the header is followed by a
+ * JackTripSubStreamHeader.
+ */
+#define BIT_RESOLUTION_SUB_STREAM 0x40
+
+struct JackTripSubStreamHeader
+{
+public:
+    uint8_t FirstChannel;  ///< Index of the first channel in the packet
+    uint8_t TotalChannels; ///< Number of channels in the whole block
+};
+
+#define SUB_STREAM_HEADER_SIZE sizeof(JackTripSubStreamHeader)
+
+/**
+ * Flag set in BitResolution, by JackTripClient peers only, when silent
+ * channels have been left out of a packet. NumIncomingChannelsFromNet is then
+ * the number of channels the packet represents, and the header (and any
+ * sub-stream header) is followed by a bitmask, dtxMaskSize() bytes long, in
+ * which bit n (bit n % 8 of byte n / 8) is set if channel n is present. Only
+ * present channels follow; the rest are silent.
+ */
+#define BIT_RESOLUTION_DTX 0x80
+
+/**
+ * Get the size, in bytes, of the DTX bitmask for a number of channels.
+ */
+inline uint8_t dtxMaskSize(uint8_t numChannels)
+{
+    return (numChannels + 7) / 8;
+}
+
+/**
+ * Check whether a channel is present according to a DTX bitmask.
+ * @param mask the bitmask, or nullptr if all channels are present.
+ */
+inline bool isChannelPresent(const uint8_t *mask, uint8_t channel)
+{
+    return mask == nullptr || (mask[channel / 8] >> (channel % 8)) & 1;
+}
+
+/**
+ * Two-way clock synchronisation exchange, between a JackTripClient and a
+ * responder such as scripts/clock-sync-responder.py; not part of JackTrip.
+ * The client sends a request with the server fields zeroed, and the responder
+ * returns it with them filled in from its own clock, in microseconds.
+ */
+struct ClockSyncPacket
+{
+public:
+    char Magic[8];          ///< CLOCK_SYNC_MAGIC
+    uint32_t Id;            ///< Request number, echoed by the responder
+    uint32_t ClientSend;    ///< Client's micros() when it sent the request
+    uint64_t ServerReceive; ///< Responder's time when the request arrived
+    uint64_t ServerSend;    ///< Responder's time when it sent the response
+};
+
+#define CLOCK_SYNC_MAGIC "JTCLKSYN"
+#define CLOCK_SYNC_PACKET_SIZE sizeof(ClockSyncPacket)
+
+/**
+ * Get the sampling rate, in Hz, represented by a samplingRateT.
+ * @return the sampling rate, or 0 if undefined.
+ */
+inline float samplingRateToHz(uint8_t samplingRate)
+{
+    switch (samplingRate) {
+        case SR22: return 22050.f;
+        case SR32: return 32000.f;
+        case SR44: return 44100.f;
+        case SR48: return 48000.f;
+        case SR88: return 88200.f;
+        case SR96: return 96000.f;
+        case SR192: return 192000.f;
+        default: return 0.f;
+    }
+}
+
 #endif //JACKTRIP_TEENSY_PACKETHEADER_H
@@ -11,6 +11,8 @@ PacketStats::PacketStats() {
 void PacketStats::reset() {
     totalReceived = 0;
     totalSent = 0;
+    totalSkipped = 0;
+    numCatchUps = 0;
     lastReceived = JackTripPacketHeader{};
     lastSent = JackTripPacketHeader{};
     receiveInterval = PacketDelta{};
@@ -27,7 +29,8 @@ void PacketStats::printStats() {
                       "receive | %9" PRId32 " | %16" PRIu64 "    | %11" PRIu16 " | %d/%.4f/%d µs | %d/%.4f/%d\n"
                       "   send | %9" PRId32 " | %16" PRIu64 "    | %11" PRIu16 " | %d/%.4f/%d µs | %d/%.4f/%d\n"
                       "  delta | %9" PRId32 " | %16" PRId64 " µs | %11" PRId16 "\n"
-                      "  ratio | %.7f\n\n",
+                      "  ratio | %.7f\n"
+                      "skipped | %9" PRId32 " samples in %" PRId32 " catch-ups\n\n",
                       totalReceived,
                       lastReceived.TimeStamp, lastReceived.SeqNumber,
                       receiveInterval.min, receiveInterval.mean, receiveInterval.max,
@@ -39,7 +42,8 @@ void PacketStats::printStats() {
                       totalReceived - totalSent,
                       static_cast<int64_t>(lastReceived.TimeStamp) - static_cast<int64_t>(lastSent.TimeStamp),
                       static_cast<int16_t>(lastReceived.SeqNumber) - static_cast<int16_t>(lastSent.SeqNumber),
-                      static_cast<float>(totalReceived) / static_cast<float>(totalSent)
+                      static_cast<float>(totalReceived) / static_cast<float>(totalSent),
+                      totalSkipped, numCatchUps
         );
 
         elapsed = 0;
@@ -96,6 +100,11 @@ void PacketStats::registerReceive(JackTripPacketHeader &header) {
     lastReceived = header;
 }
 
+void PacketStats::registerCatchUp(uint32_t numSamples) {
+    totalSkipped += numSamples;
+    ++numCatchUps;
+}
+
 void PacketStats::registerSend(JackTripPacketHeader &header) {
     ++totalSent;
 
@@ -24,6 +24,11 @@ public:
 
     void registerSend(JackTripPacketHeader &header);
 
+    /**
+     * Count samples skipped to catch up after a burst.
+     */
+    void registerCatchUp(uint32_t numSamples);
+
 private:
     struct PacketDelta{
         int32_t min{INT32_MAX}, max{INT32_MIN};
@@ -32,6 +37,8 @@ private:
     const int IGNORE_JUNK{100};
     int32_t totalSent{0};
     int32_t totalReceived{0};
+    int32_t totalSkipped{0};
+    int32_t numCatchUps{0};
     JackTripPacketHeader lastSent{};
     JackTripPacketHeader lastReceived{};
     PacketDelta receiveInterval;
@@ -0,0 +1,210 @@
+#include "SampleFormat.h"
+
+/**
+ * Full scale for float samples.
+ */
+static constexpr float FLOAT_SCALE{32768.f};
+
+/**
+ * IMA-ADPCM quantiser step sizes, and step index adjustments per code.
+ */
+static const int16_t ADPCM_STEPS[89]{
+        7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88,
+        97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+        724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660,
+        4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818,
+        18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+static const int8_t ADPCM_INDEX_ADJUST[8]{-1, -1, -1, -1, 2, 4, 6, 8};
+static constexpr uint8_t ADPCM_MAX_INDEX{88};
+
+#if defined(__ARM_ARCH_7EM__)
+/**
+ * Halfword-wise unsigned add, wrapping, and unsigned subtract, saturating at
+ * zero.
+ */
+static inline uint32_t uadd16(uint32_t a, uint32_t b) {
+    uint32_t out;
+    asm volatile("uadd16 %0, %1, %2" : "=r" (out) : "r" (a), "r" (b));
+    return out;
+}
+
+static inline uint32_t uqsub16(uint32_t a, uint32_t b) {
+    uint32_t out;
+    asm volatile("uqsub16 %0, %1, %2" : "=r" (out) : "r" (a), "r" (b));
+    return out;
+}
+#endif
+
+static inline int16_t saturate16(int32_t value) {
+    return static_cast<int16_t>(value > INT16_MAX ? INT16_MAX : (value < INT16_MIN ? INT16_MIN : value));
+}
+
+/**
+ * Apply an ADPCM code to the predictor and step index, as both encoder and
+ * decoder must.
+ */
+static inline void adpcmStep(uint8_t code, int32_t &predictor, uint8_t &index) {
+    auto step{ADPCM_STEPS[index]};
+    auto diff{step >> 3};
+    if (code & 4) diff += step;
+    if (code & 2) diff += step >> 1;
+    if (code & 1) diff += step >> 2;
+    predictor = saturate16(code & 8 ? predictor - diff : predictor + diff);
+    auto next{index + ADPCM_INDEX_ADJUST[code & 7]};
+    index = static_cast<uint8_t>(next < 0 ? 0 : (next > ADPCM_MAX_INDEX ? ADPCM_MAX_INDEX : next));
+}
+
+static void unpackAdpcm(const uint8_t *src, int16_t *dest, uint16_t numSamples) {
+    if (numSamples == 0) {
+        return;
+    }
+
+    int32_t predictor{static_cast<int16_t>(src[0] | (src[1] << 8))};
+    uint8_t index{src[2] > ADPCM_MAX_INDEX ? ADPCM_MAX_INDEX : src[2]};
+    auto codes{src + ADPCM_HEADER_SIZE};
+
+    dest[0] = static_cast<int16_t>(predictor);
+    for (uint16_t n = 1; n < numSamples; ++n) {
+        auto byte{codes[(n - 1) >> 1]};
+        adpcmStep((n & 1) ? byte & 0xf : byte >> 4, predictor, index);
+        dest[n] = static_cast<int16_t>(predictor);
+    }
+}
+
+static void packAdpcm(const int16_t *src, uint8_t *dest, uint16_t numSamples) {
+    if (numSamples == 0) {
+        return;
+    }
+
+    // Start from the first sample, with a step suited to the first
+    // difference, so that each packet is coded independently.
+    int32_t predictor{src[0]};
+    uint8_t index{0};
+    if (numSamples > 1) {
+        auto firstDiff{abs(src[1] - src[0])};
+        while (index < ADPCM_MAX_INDEX && ADPCM_STEPS[index] * 2 < firstDiff) {
+            ++index;
+        }
+    }
+    memcpy(dest, src, sizeof(int16_t));
+    dest[2] = index;
+    dest[3] = 0;
+    auto codes{dest + ADPCM_HEADER_SIZE};
+
+    for (uint16_t n = 1; n < numSamples; ++n) {
+        int32_t diff{src[n] - predictor};
+        uint8_t code{0};
+        if (diff < 0) {
+            code = 8;
+            diff = -diff;
+        }
+        int32_t step{ADPCM_STEPS[index]};
+        if (diff >= step) {
+            code |= 4;
+            diff -= step;
+        }
+        step >>= 1;
+        if (diff >= step) {
+            code |= 2;
+            diff -= step;
+        }
+        step >>= 1;
+        if (diff >= step) {
+            code |= 1;
+        }
+        adpcmStep(code, predictor, index);
+
+        if (n & 1) {
+            codes[(n - 1) >> 1] = code;
+        } else {
+            codes[(n - 1) >> 1] |= code << 4;
+        }
+    }
+}
+
+void unpackSamples(const uint8_t *src, int16_t *dest, uint16_t numSamples, uint8_t bitResolution) {
+    switch (bitResolution) {
+        case BIT8 * 8:
+            for (uint16_t n = 0; n < numSamples; ++n) {
+                dest[n] = static_cast<int16_t>(static_cast<int8_t>(src[n]) * 256);
+            }
+            break;
+        case BIT16 * 8:
+            memcpy(dest, src, numSamples * sizeof(int16_t));
+            break;
+        case BIT24 * 8:
+            // Round on the top bit of the fraction byte.
+            for (uint16_t n = 0; n < numSamples; ++n, src += 3) {
+                auto whole{static_cast<int16_t>(src[0] | (src[1] << 8))};
+                dest[n] = saturate16(whole + (src[2] >> 7));
+            }
+            break;
+        case BIT32 * 8:
+            for (uint16_t n = 0; n < numSamples; ++n, src += 4) {
+                float value;
+                memcpy(&value, src, sizeof(float));
+                value *= FLOAT_SCALE;
+                dest[n] = saturate16(static_cast<int32_t>(value < 0.f ? value - .5f : value + .5f));
+            }
+            break;
+        case ADPCM_BIT_RESOLUTION:
+            unpackAdpcm(src, dest, numSamples);
+            break;
+        default:
+            break;
+    }
+}
+
+void packSamples(const int16_t *src, uint8_t *dest, uint16_t numSamples, uint8_t bitResolution) {
+    switch (bitResolution) {
+        case BIT8 * 8:
+            for (uint16_t n = 0; n < numSamples; ++n) {
+                dest[n] = static_cast<uint8_t>(src[n] >> 8);
+            }
+            break;
+        case BIT16 * 8:
+            memcpy(dest, src, numSamples * sizeof(int16_t));
+            break;
+        case BIT24 * 8:
+            for (uint16_t n = 0; n < numSamples; ++n, dest += 3) {
+                memcpy(dest, src + n, sizeof(int16_t));
+                dest[2] = 0;
+            }
+            break;
+        case BIT32 * 8:
+            for (uint16_t n = 0; n < numSamples; ++n, dest += 4) {
+                auto value{static_cast<float>(src[n]) / FLOAT_SCALE};
+                memcpy(dest, &value, sizeof(float));
+            }
+            break;
+        case ADPCM_BIT_RESOLUTION:
+            packAdpcm(src, dest, numSamples);
+            break;
+        default:
+            break;
+    }
+}
+
+bool isSilent(const int16_t *samples, uint16_t numSamples, int16_t threshold) {
+    // A sample lies within [-t, t] if, offset by t, it's no more than 2t as
+    // an unsigned 16-bit value; anything outside wraps or exceeds 2t. OR
+    // together the excess over 2t rather than branching per sample.
+    auto bias{static_cast<uint16_t>(threshold)};
+    auto limit{static_cast<uint16_t>(2 * threshold)};
+    uint32_t excess{0};
+    uint16_t n{0};
+#if defined(__ARM_ARCH_7EM__)
+    auto biasPair{bias * 0x10001u}, limitPair{limit * 0x10001u};
+    for (; n + 1 < numSamples; n += 2) {
+        uint32_t pair;
+        memcpy(&pair, samples + n, sizeof(pair));
+        excess |= uqsub16(uadd16(pair, biasPair), limitPair);
+    }
+#endif
+    for (; n < numSamples; ++n) {
+        auto offset{static_cast<uint16_t>(samples[n] + bias)};
+        excess |= offset > limit ? offset - limit : 0u;
+    }
+    return excess == 0;
+}
@@ -0,0 +1,88 @@
+#ifndef JACKTRIP_TEENSY_SAMPLEFORMAT_H
+#define JACKTRIP_TEENSY_SAMPLEFORMAT_H
+
+#include <Arduino.h>
+#include "PacketHeader.h"
+
+/**
+ * Conversion between JackTrip's wire formats and the Teensy Audio Library's
+ * 16-bit samples. All formats are little-endian:
+ * -  8 bits: int8;
+ * - 16 bits: int16;
+ * - 24 bits: int16, followed by a uint8 fraction in 1/256ths of the int16's
+ *   least significant bit;
+ * - 32 bits: float, in [-1, 1).
+ * Additionally, though JackTrip itself doesn't support it, a BitResolution of
+ * ADPCM_BIT_RESOLUTION denotes IMA-ADPCM at 4 bits per sample. Each channel
+ * of each packet is coded independently, as a 4-byte header (the first
+ * sample, as int16, then the initial step index and a zero byte) followed by
+ * the remaining samples' codes, two per byte, low nibble first.
+ */
+
+constexpr uint8_t ADPCM_BIT_RESOLUTION{4};
+/**
+ * Size, in bytes, of the header of each ADPCM-coded channel.
+ */
+constexpr uint8_t ADPCM_HEADER_SIZE{4};
+
+/**
+ * Get the number of bytes per sample on the wire.
+ * @param bitResolution bits per sample, as in JackTripPacketHeader.
+ * @return bytes per sample, or 0 if the resolution isn't supported.
+ */
+inline uint8_t bytesPerSample(uint8_t bitResolution) {
+    switch (bitResolution) {
+        case BIT8 * 8:
+        case BIT16 * 8:
+        case BIT24 * 8:
+        case BIT32 * 8:
+            return bitResolution / 8;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Check whether a bit resolution, as in JackTripPacketHeader, is supported.
+ */
+inline bool isSupportedResolution(uint8_t bitResolution) {
+    return bitResolution == ADPCM_BIT_RESOLUTION || bytesPerSample(bitResolution) > 0;
+}
+
+/**
+ * Get the number of bytes one channel's worth of samples occupies on the
+ * wire.
+ * @param bitResolution bits per sample; must be supported.
+ */
+inline uint16_t channelBytes(uint8_t bitResolution, uint16_t numSamples) {
+    return bitResolution == ADPCM_BIT_RESOLUTION
+           ? ADPCM_HEADER_SIZE + numSamples / 2
+           : numSamples * bytesPerSample(bitResolution);
+}
+
+/**
+ * Convert samples from wire format, rounding and saturating to 16 bits.
+ * @param src channelBytes(bitResolution, numSamples) bytes in wire format.
+ * @param dest numSamples 16-bit samples.
+ * @param bitResolution bits per sample; must be supported.
+ */
+void unpackSamples(const uint8_t *src, int16_t *dest, uint16_t numSamples, uint8_t bitResolution);
+
+/**
+ * Convert 16-bit samples to wire format.
+ * @param src numSamples 16-bit samples.
+ * @param dest channelBytes(bitResolution, numSamples) bytes in wire format.
+ * @param bitResolution bits per sample; must be supported.
+ */
+void packSamples(const int16_t *src, uint8_t *dest, uint16_t numSamples, uint8_t bitResolution);
+
+/**
+ * Check whether every sample lies within [-threshold, threshold], e.g. so
+ * that a silent channel needn't be sent. Scans two samples at a time on
+ * Cortex-M7.
+ * @param threshold largest magnitude to treat as silence; 0 for digital
+ * silence only.
+ */
+bool isSilent(const int16_t *samples, uint16_t numSamples, int16_t threshold);
+
+#endif //JACKTRIP_TEENSY_SAMPLEFORMAT_H
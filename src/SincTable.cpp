@@ -0,0 +1,135 @@
+#include "SincTable.h"
+
+float SincTable::interpolationTable[(PHASES + 1) * TAPS];
+bool SincTable::interpolationTableReady{false};
+SincTable::Slot SincTable::slots[SINC_TABLE_SLOTS];
+float SincTable::unavailableCutoff{0.f};
+
+void SincTable::request(float ratio) {
+    auto cutoff{getCutoff(ratio)};
+    if (isSameCutoff(cutoff, CUTOFF)) {
+        return;
+    }
+
+    for (auto &slot: slots) {
+        if (slot.state.load(std::memory_order_acquire) != State::EMPTY
+            && isSameCutoff(cutoff, slot.cutoff.load(std::memory_order_relaxed))) {
+            return;
+        }
+    }
+
+    for (auto &slot: slots) {
+        auto expected{State::EMPTY};
+        // Claim the slot before describing it, in case of a concurrent request.
+        if (slot.state.compare_exchange_strong(expected, State::REQUESTED, std::memory_order_relaxed)) {
+            slot.cutoff.store(cutoff, std::memory_order_release);
+            return;
+        }
+    }
+
+    // No free slot; take over one that no buffer is using. Claim it before
+    // checking for users, so that a concurrent acquire() either sees it
+    // claimed or is seen.
+    for (auto &slot: slots) {
+        auto expected{State::READY};
+        if (slot.state.compare_exchange_strong(expected, State::REQUESTED)) {
+            if (slot.users.load() == 0) {
+                slot.cutoff.store(cutoff, std::memory_order_release);
+                return;
+            }
+            slot.state.store(State::READY);
+        }
+    }
+
+    if (!isSameCutoff(cutoff, unavailableCutoff)) {
+        unavailableCutoff = cutoff;
+        Serial.printf("SincTable: No free slot for a ratio of %.4f; reading without band-limiting\n", ratio);
+    }
+}
+
+void SincTable::prepare() {
+    if (!interpolationTableReady) {
+        build(interpolationTable, CUTOFF);
+        interpolationTableReady = true;
+    }
+
+    for (auto &slot: slots) {
+        if (slot.state.load(std::memory_order_acquire) == State::REQUESTED) {
+            if (slot.coeffs == nullptr) {
+                slot.coeffs = new float[(PHASES + 1) * TAPS];
+            }
+            build(slot.coeffs, slot.cutoff.load(std::memory_order_acquire));
+            slot.state.store(State::READY, std::memory_order_release);
+        }
+    }
+}
+
+const float *SincTable::acquire(float ratio) {
+    auto cutoff{getCutoff(ratio)};
+    if (!isSameCutoff(cutoff, CUTOFF)) {
+        for (auto &slot: slots) {
+            // Count the user before checking the slot; see request().
+            slot.users.fetch_add(1);
+            if (slot.state.load() == State::READY
+                && isSameCutoff(cutoff, slot.cutoff.load(std::memory_order_relaxed))) {
+                return slot.coeffs;
+            }
+            slot.users.fetch_sub(1);
+        }
+    }
+    return interpolationTable;
+}
+
+void SincTable::release(const float *table) {
+    for (auto &slot: slots) {
+        if (table == slot.coeffs) {
+            slot.users.fetch_sub(1);
+            return;
+        }
+    }
+}
+
+float SincTable::getCutoff(float ratio) {
+    // When reading faster than writing, i.e. decimating, lower the cutoff to
+    // the read Nyquist frequency.
+    return ratio > 1.f ? CUTOFF / ratio : CUTOFF;
+}
+
+bool SincTable::isSameCutoff(float a, float b) {
+    return fabsf(a / b - 1.f) <= TOLERANCE;
+}
+
+void SincTable::build(float *coeffs, float cutoff) {
+    // Zeroth-order modified Bessel function of the first kind, for the Kaiser
+    // window.
+    auto besselI0 = [](float x) {
+        auto sum{1.f}, term{1.f};
+        for (int k = 1; k < 20; ++k) {
+            term *= (x / (2.f * static_cast<float>(k))) * (x / (2.f * static_cast<float>(k)));
+            sum += term;
+        }
+        return sum;
+    };
+
+    auto halfWidth{static_cast<float>(TAPS / 2)};
+    auto windowNorm{besselI0(KAISER_BETA)};
+
+    for (int p = 0; p <= PHASES; ++p) {
+        auto alpha{static_cast<float>(p) / static_cast<float>(PHASES)};
+        auto row{coeffs + p * TAPS};
+        auto sum{0.f};
+        for (int j = 0; j < TAPS; ++j) {
+            auto t{static_cast<float>(j - (TAPS / 2 - 1)) - alpha};
+            auto x{t / halfWidth};
+            auto window{fabsf(x) < 1.f ? besselI0(KAISER_BETA * sqrtf(1.f - x * x)) / windowNorm : 0.f};
+            auto arg{PI * cutoff * t};
+            auto sinc{fabsf(arg) < 1e-6f ? 1.f : sinf(arg) / arg};
+            row[j] = cutoff * sinc * window;
+            sum += row[j];
+        }
+        // Normalise for unity gain at DC.
+        for (int j = 0; j < TAPS; ++j) {
+            row[j] /= sum;
+        }
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef JACKTRIP_TEENSY_SINCTABLE_H
+#define JACKTRIP_TEENSY_SINCTABLE_H
+
+#include <Arduino.h>
+#include <atomic>
+
+/**
+ * Number of distinct sinc tables, beyond the one used for interpolation, that
+ * may be in use at once; one per decimating ratio, e.g. one for each direction
+ * of a client resampling to and from a server.
+ */
+#ifndef SINC_TABLE_SLOTS
+#define SINC_TABLE_SLOTS 2
+#endif
+
+/**
+ * Polyphase windowed-sinc coefficients for CircularBufferMulti's
+ * Interpolation::SINC: (PHASES + 1) rows of TAPS coefficients. The cutoff
+ * depends on the write:read ratio only when decimating, so every buffer that
+ * interpolates shares one table, and those decimating at the same ratio share
+ * another. Building a table takes far too long for an audio interrupt, so
+ * tables are only requested there, and built by prepare(), from loop(). A
+ * table no buffer has acquired may be rebuilt for another ratio.
+ */
+class SincTable {
+public:
+    /**
+     * Taps per phase.
+     */
+    static constexpr int TAPS{32};
+    /**
+     * Phases; coefficients are linearly interpolated between adjacent phases.
+     */
+    static constexpr int PHASES{64};
+
+    /**
+     * Ask for the table for a write:read ratio to be built by the next
+     * prepare(), unless it already exists, in a free slot or else one that no
+     * buffer has acquired. May be called from any context.
+     */
+    static void request(float ratio);
+
+    /**
+     * Build any requested tables. Call from loop(), or setup().
+     */
+    static void prepare();
+
+    /**
+     * Get the table for a write:read ratio, or, until prepare() has built it,
+     * the table for interpolation, and keep it from being rebuilt until
+     * released. May be called from any context.
+     */
+    static const float *acquire(float ratio);
+
+    /**
+     * Let a table got via acquire() be rebuilt for another ratio.
+     */
+    static void release(const float *table);
+
+private:
+    /**
+     * Cutoff, relative to the lower of the write and read Nyquist
+     * frequencies.
+     */
+    static constexpr float CUTOFF{.9f};
+    static constexpr float KAISER_BETA{7.f};
+    /**
+     * Relative difference in cutoff within which tables are shared; smaller
+     * differences are inaudible.
+     */
+    static constexpr float TOLERANCE{.001f};
+
+    enum class State : uint8_t {
+        EMPTY,
+        REQUESTED,
+        READY
+    };
+
+    struct Slot {
+        std::atomic<State> state{State::EMPTY};
+        std::atomic<float> cutoff{0.f};
+        /**
+         * Number of acquire()s not yet released.
+         */
+        std::atomic<uint8_t> users{0};
+        float *coeffs{nullptr};
+    };
+
+    static float getCutoff(float ratio);
+
+    static bool isSameCutoff(float a, float b);
+
+    static void build(float *coeffs, float cutoff);
+
+    static float interpolationTable[(PHASES + 1) * TAPS];
+    static bool interpolationTableReady;
+    static Slot slots[SINC_TABLE_SLOTS];
+    /**
+     * Cutoff last reported as having no slot, so as to report it only once.
+     */
+    static float unavailableCutoff;
+};
+
+
+#endif //JACKTRIP_TEENSY_SINCTABLE_H